@@ -0,0 +1,8 @@
+#version 320 es
+precision lowp float;
+
+void
+main()
+{
+    /* gl_FragDepth = gl_FragCoord.z */
+}
@@ -0,0 +1,27 @@
+#version 320 es
+
+layout (location = 0) in vec3 aPos;
+layout (location = 5) in mat4 aInstanceModel; /* identity if not instanced */
+
+layout (std140) uniform ubProjView
+{
+    mat4 uProj;
+    mat4 uView;
+};
+
+layout (std140) uniform ubDraw
+{
+    mat4 uModel;
+    mat3 uNormalMatrix;
+    bool uQuantized; /* normals and tangents are octahedral encoded */
+};
+
+/* shading pass tests with GL_EQUAL, so depth has to match omniDirShadow.vert bit for bit */
+invariant gl_Position;
+
+void
+main()
+{
+    vec4 worldPos = uModel * aInstanceModel * vec4(aPos, 1.0);
+    gl_Position = uProj * uView * worldPos;
+}
@@ -0,0 +1,9 @@
+#version 320 es
+
+/* one triangle over the whole target, no vertex data, draw 3 vertices with any vao */
+void
+main()
+{
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
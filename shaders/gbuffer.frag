@@ -0,0 +1,37 @@
+#version 320 es
+precision highp float;
+
+/* deferred path geometry pass, with omniDirShadow.vert */
+
+in VOut {
+    vec3 fragPos;
+    vec3 norm;
+    vec2 tex;
+} vIn;
+
+uniform sampler2D uDiffuseTex;
+
+layout (location = 0) out vec4 outAlbedo;
+layout (location = 1) out vec4 outNormal;
+
+/* octahedral mapping, two channels are enough for a unit vector */
+vec2
+octEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+
+    return n.xy;
+}
+
+void
+main()
+{
+    vec4 color = texture(uDiffuseTex, vIn.tex);
+    if (color.a < 0.1)
+        discard;
+
+    outAlbedo = vec4(color.rgb, 1.0);
+    outNormal = vec4(octEncode(normalize(vIn.norm)) * 0.5 + 0.5, 0.0, 0.0);
+}
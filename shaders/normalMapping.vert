@@ -1,9 +1,9 @@
 #version 320 es
 
-layout (location = 0) in vec3 aPos;
+layout (location = 0) in vec4 aPos; /* w is the bitangent sign when quantized */
 layout (location = 1) in vec2 aTex;
 layout (location = 2) in vec3 aNorm;
-layout (location = 3) in vec3 aTan;
+layout (location = 3) in vec4 aTan; /* w is the bitangent sign for gltf tangents */
 
 layout (std140) uniform ubProjView
 {
@@ -11,8 +11,12 @@ layout (std140) uniform ubProjView
     mat4 uView;
 };
 
-uniform mat4 uModel;
-uniform mat3 uNormalMatrix;
+layout (std140) uniform ubDraw
+{
+    mat4 uModel;
+    mat3 uNormalMatrix;
+    bool uQuantized; /* normals and tangents are octahedral encoded */
+};
 
 uniform vec3 uLightPos;
 uniform vec3 uViewPos;
@@ -27,22 +31,36 @@ out VOut {
     vec3 tanFragPos;
 } vOut;
 
+vec3
+octDecode(vec2 e)
+{
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+
+    return normalize(v);
+}
+
 void
 main()
 {
-    vOut.fragPos = vec3(uModel * vec4(aPos, 1.0));
+    vec4 pos = vec4(aPos.xyz, 1.0);
+    vOut.fragPos = vec3(uModel * pos);
     vOut.tex = aTex;
 
-    vec3 t = normalize(uNormalMatrix * aTan);
-    vec3 n = normalize(uNormalMatrix * aNorm);
+    vec3 tan = uQuantized ? octDecode(aTan.xy) : aTan.xyz;
+    vec3 norm = uQuantized ? octDecode(aNorm.xy) : aNorm;
+
+    vec3 t = normalize(uNormalMatrix * tan);
+    vec3 n = normalize(uNormalMatrix * norm);
     // t = normalize(t - dot(t, n) * n);
-    // vec3 bitan = normalize(cross(n, t));
-    vec3 b = normalize(uNormalMatrix * aTan);
+    /* unused components default to 1, so only one of the signs is set */
+    vec3 b = cross(n, t) * aPos.w * aTan.w;
     mat3 tbn = transpose(mat3(t, b, n));
 
     vOut.tanLightPos = tbn * uLightPos;
     vOut.tanViewPos = tbn * uViewPos;
     vOut.tanFragPos = tbn * vOut.fragPos;
     
-    gl_Position = uProj * uView * uModel * vec4(aPos, 1.0);
+    gl_Position = uProj * uView * uModel * pos;
 }
@@ -1,11 +1,17 @@
 #version 320 es
 
 layout (location = 0) in vec3 aPos;
+layout (location = 5) in mat4 aInstanceModel; /* identity if not instanced */
 
-uniform mat4 uModel;
+layout (std140) uniform ubDraw
+{
+    mat4 uModel;
+    mat3 uNormalMatrix;
+    bool uQuantized; /* normals and tangents are octahedral encoded */
+};
 
 void
 main()
 {
-    gl_Position = uModel * vec4(aPos, 1.0);
+    gl_Position = uModel * aInstanceModel * vec4(aPos, 1.0);
 }
@@ -0,0 +1,22 @@
+#version 320 es
+
+layout (location = 0) in vec3 aPos;
+layout (location = 5) in mat4 aInstanceModel; /* identity if not instanced */
+
+layout (std140) uniform ubDraw
+{
+    mat4 uModel;
+    mat3 uNormalMatrix;
+    bool uQuantized; /* normals and tangents are octahedral encoded */
+};
+
+uniform mat4 uShadowMatrix; /* of the face attached to the framebuffer */
+
+out vec4 gFragPos; /* named like the geometry shader output, so cubeMapDepth.frag serves both paths */
+
+void
+main()
+{
+    gFragPos = uModel * aInstanceModel * vec4(aPos, 1.0);
+    gl_Position = uShadowMatrix * gFragPos;
+}
@@ -0,0 +1,47 @@
+#version 320 es
+precision highp float;
+
+/* downsamples one face of the depth cube into exponential moments, averaging a 4x4 block of taps.
+ * taps past the face edge go into the neighbour face, so there are no seams */
+
+uniform highp samplerCube uDepthMap;
+uniform int uFace;
+uniform float uSize; /* of the target face */
+uniform float uTexel; /* depth cube texel in face coords, which span [-1, 1] */
+uniform float uExponent;
+
+out vec2 outMoments;
+
+/* inverse of the cube map face selection */
+vec3
+faceDir(vec2 st)
+{
+    switch (uFace)
+    {
+        case 0: return vec3(1.0, -st.y, -st.x);
+        case 1: return vec3(-1.0, -st.y, st.x);
+        case 2: return vec3(st.x, 1.0, st.y);
+        case 3: return vec3(st.x, -1.0, -st.y);
+        case 4: return vec3(st.x, -st.y, 1.0);
+        default: return vec3(-st.x, -st.y, -1.0);
+    }
+}
+
+void
+main()
+{
+    vec2 st = gl_FragCoord.xy / uSize * 2.0 - 1.0;
+
+    vec2 sum = vec2(0.0);
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            float depth = texture(uDepthMap, faceDir(st + (vec2(x, y) - 1.5) * uTexel)).r;
+            float e = exp(uExponent * depth);
+            sum += vec2(e, e * e);
+        }
+    }
+
+    outMoments = sum * (1.0 / 16.0);
+}
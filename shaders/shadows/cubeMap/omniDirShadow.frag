@@ -1,6 +1,24 @@
 #version 320 es
 precision highp float;
 
+#ifdef DEFERRED_LIGHTING
+/* once per pixel over the gbuffer, with fullscreen.vert */
+uniform highp sampler2D uGAlbedo;
+uniform highp sampler2D uGNormal;
+uniform highp sampler2D uGDepth;
+uniform mat4 uInvProjView;
+uniform vec2 uInvRenderSize; /* the rendered part of the gbuffer can be smaller than the textures */
+
+vec3
+octDecode(vec2 e)
+{
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+
+    return normalize(v);
+}
+#else
 in VOut {
     vec3 fragPos;
     vec3 norm;
@@ -8,6 +26,7 @@ in VOut {
 } vIn;
 
 uniform sampler2D uDiffuseTex;
+#endif
 uniform samplerCube uDepthMap;
 
 uniform vec3 uLightPos;
@@ -16,8 +35,78 @@ uniform vec3 uViewPos;
 
 uniform float uFarPlane;
 
+layout (std140) uniform ubProjView
+{
+    mat4 uProj;
+    mat4 uView;
+};
+
+/* clustered point lights, see LightClusters */
+struct PointLight
+{
+    vec4 posRadius;
+    vec4 color;
+};
+
+layout (std140) uniform ubPointLights
+{
+    PointLight uPointLights[512];
+};
+
+uniform highp usamplerBuffer uClusterGrid; /* offset and count per cluster */
+uniform highp usamplerBuffer uClusterLights; /* light indices */
+uniform vec3 uClusterDims;
+uniform vec3 uClusterScale; /* gl_FragCoord.xy and log view depth to cluster coords */
+uniform float uClusterBias;
+
+/* point light shadows, see ShadowAtlas */
+struct AtlasShadow
+{
+    vec4 rect; /* xy: first face origin, z: face size */
+    vec4 posFar;
+};
+
+layout (std140) uniform ubShadowAtlas
+{
+    AtlasShadow uAtlasShadows[32];
+};
+
+uniform highp sampler2D uShadowAtlas;
+
+#ifdef COUNT_FRAGMENTS
+/* depth test runs before the shader, so only fragments that get shaded are counted */
+layout (early_fragment_tests) in;
+layout (binding = 0, offset = 0) uniform atomic_uint uShadedFragments;
+#endif
+
 out vec4 outColor;
 
+#ifdef PREFILTERED_SHADOWS
+uniform samplerCube uMomentMap; /* exp(c * depth) and its square, filtered by momentFilter.frag */
+uniform float uMomentExponent; /* c */
+
+/* one filtered lookup, the chebyshev bound of the moments gives how much of the filter area is closer than us */
+float
+shadowCalculation(vec3 fragPos)
+{
+    vec3 fragToLight = fragPos - uLightPos;
+    float depth = (length(fragToLight) - 0.02) / uFarPlane;
+    float e = exp(uMomentExponent * depth);
+    vec2 m = texture(uMomentMap, fragToLight).rg;
+
+    if (e <= m.x)
+        return 0.0;
+
+    /* floor is a couple of centimeters of depth spread, scaled into the warped space */
+    float minVariance = 1e-6 * (uMomentExponent * e) * (uMomentExponent * e);
+    float variance = max(m.y - m.x * m.x, minVariance);
+    float d = e - m.x;
+    float pMax = variance / (variance + d * d);
+
+    /* cut the tail that makes light bleed through overlapping occluders */
+    return 1.0 - clamp((pMax - 0.3) / 0.7, 0.0, 1.0);
+}
+#else
 vec3 sampleOffsetDirections[20] = vec3[](
     vec3( 1, 1, 1), vec3( 1,-1, 1), vec3(-1,-1, 1), vec3(-1, 1, 1),
     vec3( 1, 1,-1), vec3( 1,-1,-1), vec3(-1,-1,-1), vec3(-1, 1,-1),
@@ -55,29 +144,130 @@ shadowCalculation(vec3 fragPos)
 
     return shadow * (1.0 / float(samples));
 }
+#endif
+
+float
+atlasShadow(int slot, vec3 fragPos)
+{
+    AtlasShadow s = uAtlasShadows[slot];
+    vec3 v = fragPos - s.posFar.xyz;
+    vec3 a = abs(v);
+
+    /* face selection as in the cube map lookup, faces are rendered with the same orientation */
+    int face;
+    vec2 st;
+    float ma;
+    if (a.x >= a.y && a.x >= a.z)
+    {
+        face = v.x > 0.0 ? 0 : 1;
+        st = vec2(v.x > 0.0 ? -v.z : v.z, -v.y);
+        ma = a.x;
+    }
+    else if (a.y >= a.z)
+    {
+        face = v.y > 0.0 ? 2 : 3;
+        st = vec2(v.x, v.y > 0.0 ? v.z : -v.z);
+        ma = a.y;
+    }
+    else
+    {
+        face = v.z > 0.0 ? 4 : 5;
+        st = vec2(v.z > 0.0 ? v.x : -v.x, -v.y);
+        ma = a.z;
+    }
+
+    float texel = 1.0 / float(textureSize(uShadowAtlas, 0).x);
+    float size = s.rect.z;
+    vec2 faceMin = s.rect.xy + vec2(face % 3, face / 3) * size;
+    vec2 uv = faceMin + ((st / ma) * 0.5 + 0.5) * size;
+
+    /* keep the taps inside of the face, neighbours in the atlas belong to other faces or lights */
+    float currentDepth = length(v) - 0.02;
+    float shadow = 0.0;
+    for (int i = 0; i < 4; i++)
+    {
+        vec2 tap = clamp(uv + (vec2(i % 2, i / 2) - 0.5) * texel, faceMin + texel * 0.5, faceMin + size - texel * 0.5);
+        if (currentDepth > texture(uShadowAtlas, tap).r * s.posFar.w)
+            shadow += 0.25;
+    }
+
+    return shadow;
+}
+
+vec3
+pointLighting(vec3 fragPos, vec3 normal, vec3 viewDir)
+{
+    float viewDepth = -(uView * vec4(fragPos, 1.0)).z;
+    vec3 cell = vec3(gl_FragCoord.xy, log(max(viewDepth, 1e-4))) * uClusterScale + vec3(0.0, 0.0, uClusterBias);
+    ivec3 dims = ivec3(uClusterDims);
+    ivec3 c = clamp(ivec3(cell), ivec3(0), dims - 1);
+    uvec2 range = texelFetch(uClusterGrid, c.x + dims.x * (c.y + dims.y * c.z)).xy;
+
+    vec3 sum = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++)
+    {
+        PointLight l = uPointLights[texelFetch(uClusterLights, int(range.x + i)).r];
+        vec3 toLight = l.posRadius.xyz - fragPos;
+        float dist = length(toLight);
+
+        /* inverse square, windowed to zero at the radius */
+        float window = clamp(1.0 - pow(dist / l.posRadius.w, 4.0), 0.0, 1.0);
+        float atten = window * window / (dist * dist + 1.0);
+
+        vec3 lightDir = toLight / max(dist, 1e-4);
+        float diff = max(dot(lightDir, normal), 0.0);
+        float spec = pow(max(dot(normal, normalize(lightDir + viewDir)), 0.0), 64.0);
+        float shadow = l.color.w > 0.0 ? atlasShadow(int(l.color.w) - 1, fragPos) : 0.0;
+        sum += (1.0 - shadow) * (diff + spec) * atten * l.color.rgb;
+    }
+
+    return sum;
+}
 
 void
 main()
 {
-    vec4 color = texture(uDiffuseTex, vIn.tex);
+#ifdef COUNT_FRAGMENTS
+    atomicCounterIncrement(uShadedFragments);
+#endif
+
+#ifdef DEFERRED_LIGHTING
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(uGDepth, pixel, 0).r;
+    /* nothing was drawn here */
+    if (depth == 1.0)
+        discard;
 
+    vec3 ndc = vec3(gl_FragCoord.xy * uInvRenderSize, depth) * 2.0 - 1.0;
+    vec4 world = uInvProjView * vec4(ndc, 1.0);
+    vec3 fragPos = world.xyz / world.w;
+    vec4 color = texelFetch(uGAlbedo, pixel, 0);
+    vec3 normal = octDecode(texelFetch(uGNormal, pixel, 0).xy * 2.0 - 1.0);
+
+    /* depth for the forward draws that come after */
+    gl_FragDepth = depth;
+#else
+    vec3 fragPos = vIn.fragPos;
+    vec4 color = texture(uDiffuseTex, vIn.tex);
     vec3 normal = normalize(vIn.norm);
+#endif
+
     vec3 lightColor = uLightColor;
     /* ambient */
     vec3 ambient = 0.15 * color.rgb;
     /* diffuse */
-    vec3 lightDir = normalize(uLightPos - vIn.fragPos);
+    vec3 lightDir = normalize(uLightPos - fragPos);
     float diff = max(dot(lightDir, normal), 0.0);
     vec3 diffuse = diff * lightColor;
     /* specular */
-    vec3 viewDir = normalize(uViewPos - vIn.fragPos);
+    vec3 viewDir = normalize(uViewPos - fragPos);
     float spec = 0.0;
     vec3 halfwayDir = normalize(lightDir + viewDir);
     spec = pow(max(dot(normal, halfwayDir), 0.0), 64.0);
     vec3 specular = spec * lightColor;
     /* calculate shadow */
-    float shadow = shadowCalculation(vIn.fragPos);
-    vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * color.rgb;
+    float shadow = shadowCalculation(fragPos);
+    vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular) + pointLighting(fragPos, normal, viewDir)) * color.rgb;
 
     if (color.a < 0.1)
         discard;
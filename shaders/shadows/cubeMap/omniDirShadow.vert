@@ -3,6 +3,7 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTex;
 layout (location = 2) in vec3 aNorm;
+layout (location = 5) in mat4 aInstanceModel; /* identity if not instanced */
 
 layout (std140) uniform ubProjView
 {
@@ -10,29 +11,58 @@ layout (std140) uniform ubProjView
     mat4 uView;
 };
 
-uniform mat4 uModel;
-uniform mat3 uNormalMatrix;
+layout (std140) uniform ubDraw
+{
+    mat4 uModel;
+    mat3 uNormalMatrix;
+    bool uQuantized; /* normals and tangents are octahedral encoded */
+};
+
 uniform bool uReverseNorms;
 
 out vec2 vTex;
 
+/* same as depthPrepass.vert, for GL_EQUAL depth test after the pre-pass */
+invariant gl_Position;
+
 out VOut {
     vec3 fragPos;
     vec3 norm;
     vec2 tex;
 } vOut;
 
+/* inverse transpose scaled by the determinant, fine for normals that get normalized anyway */
+mat3
+cofactor(mat3 m)
+{
+    return mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+}
+
+vec3
+octDecode(vec2 e)
+{
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+
+    return normalize(v);
+}
+
 void
 main()
 {
-    vOut.fragPos = vec3(uModel * vec4(aPos, 1.0));
+    vec4 worldPos = uModel * aInstanceModel * vec4(aPos, 1.0);
+    vOut.fragPos = vec3(worldPos);
 
+    mat3 instance = mat3(aInstanceModel);
+    vec3 norm = uQuantized ? octDecode(aNorm.xy) : aNorm;
+    norm = cofactor(instance) * norm * sign(determinant(instance));
     if (uReverseNorms)
-        vOut.norm = uNormalMatrix * (-1.0 * aNorm);
+        vOut.norm = uNormalMatrix * (-1.0 * norm);
     else
-        vOut.norm = uNormalMatrix * aNorm;
+        vOut.norm = uNormalMatrix * norm;
 
     vOut.tex = aTex;
     
-    gl_Position = uProj * uView * uModel * vec4(aPos, 1.0);
+    gl_Position = uProj * uView * worldPos;
 }
@@ -10,7 +10,12 @@ layout (std140) uniform ubProjView
     mat4 uView;
 };
 
-uniform mat4 uModel;
+layout (std140) uniform ubDraw
+{
+    mat4 uModel;
+    mat3 uNormalMatrix;
+    bool uQuantized; /* normals and tangents are octahedral encoded */
+};
 
 out vec2 vsTex;
 
@@ -11,6 +11,7 @@ struct App
     bool bRunning = false;
     bool bConfigured = false;
     int swapInterval = 1;
+    double refreshRate = 60.0; /* hz of the output the window is on, if the platform reports it */
     bool bPaused = false;
     bool bRelativeMode = false;
     bool bFullscreen = false;
@@ -0,0 +1,230 @@
+#include "clusters.hh"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+    #include <immintrin.h>
+#endif
+
+LightClusters::~LightClusters()
+{
+    GLuint aTexs[] {this->gridTex, this->indexTex};
+    GLuint aBuffers[] {this->gridBuffer, this->indexBuffer};
+    glDeleteTextures(std::size(aTexs), aTexs);
+    glDeleteBuffers(std::size(aBuffers), aBuffers);
+}
+
+void
+LightClusters::create()
+{
+    glGenBuffers(1, &this->gridBuffer);
+    glGenBuffers(1, &this->indexBuffer);
+    glGenTextures(1, &this->gridTex);
+    glGenTextures(1, &this->indexTex);
+
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    this->maxIndices = std::max(maxTexels, 1);
+
+    /* texture buffers can't be empty */
+    this->aGrid.assign(COUNT * 2, 0);
+    this->aIndices.assign(1, 0);
+    this->upload();
+
+    glBindTexture(GL_TEXTURE_BUFFER, this->gridTex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, this->gridBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, this->indexTex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, this->indexBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+static inline f32
+sliceDepth(u32 slice, f32 farPlane)
+{
+    return LightClusters::SLICE_NEAR * std::pow(farPlane / LightClusters::SLICE_NEAR, static_cast<f32>(slice) / LightClusters::Z);
+}
+
+void
+LightClusters::setProjection(f32 _fov, f32 _aspect, f32 _near, f32 _far)
+{
+    if (_fov == this->fov && _aspect == this->aspect && _near == this->nearPlane && _far == this->farPlane)
+        return;
+
+    this->fov = _fov, this->aspect = _aspect, this->nearPlane = _near, this->farPlane = _far;
+
+    f32 ty = std::tan(_fov / 2);
+    f32 tx = ty * _aspect;
+    this->aBounds.resize(COUNT);
+
+    for (u32 z = 0; z < Z; z++)
+    {
+        f32 dn = z == 0 ? std::min(_near, SLICE_NEAR) : sliceDepth(z, _far);
+        f32 df = sliceDepth(z + 1, _far);
+
+        for (u32 y = 0; y < Y; y++)
+        {
+            f32 y0 = (-1.0f + 2.0f * y / Y) * ty, y1 = (-1.0f + 2.0f * (y + 1) / Y) * ty;
+
+            for (u32 x = 0; x < X; x++)
+            {
+                f32 x0 = (-1.0f + 2.0f * x / X) * tx, x1 = (-1.0f + 2.0f * (x + 1) / X) * tx;
+
+                /* tile edges are linear in depth, so the extremes are at the slice's near or far end */
+                this->aBounds[x + X * (y + Y * z)] = {
+                    .min {std::min(x0 * dn, x0 * df), std::min(y0 * dn, y0 * df), -df},
+                    .max {std::max(x1 * dn, x1 * df), std::max(y1 * dn, y1 * df), -dn}
+                };
+            }
+        }
+    }
+}
+
+v3
+LightClusters::shaderScale(GLsizei width, GLsizei height) const
+{
+    return {static_cast<f32>(X) / width, static_cast<f32>(Y) / height, Z / std::log(this->farPlane / SLICE_NEAR)};
+}
+
+f32
+LightClusters::shaderBias() const
+{
+    return -std::log(SLICE_NEAR) * this->shaderScale(1, 1).z;
+}
+
+void
+LightClusters::assign(const PointLight* pLights, u32 nLights, const m4& view, ThreadPool* pTp)
+{
+    for (auto& s : this->aSlices)
+    {
+        s.x.clear(), s.y.clear(), s.z.clear(), s.r2.clear();
+        s.aIdxs.clear();
+    }
+
+    /* bin lights into the slices their depth range overlaps */
+    f32 scaleZ = this->shaderScale(1, 1).z;
+    f32 biasZ = this->shaderBias();
+    for (u32 i = 0; i < nLights; i++)
+    {
+        const auto& l = pLights[i];
+        v4 p = view * v4(l.pos.x, l.pos.y, l.pos.z, 1.0f);
+        f32 dMin = -p.z - l.radius, dMax = -p.z + l.radius;
+        if (dMax < this->nearPlane || dMin > this->farPlane)
+            continue;
+
+        auto slice = [&](f32 d) -> u32 {
+            return d <= SLICE_NEAR ? 0 : std::min(static_cast<u32>(std::log(d) * scaleZ + biasZ), Z - 1);
+        };
+
+        for (u32 z = slice(dMin), end = slice(dMax); z <= end; z++)
+        {
+            auto& s = this->aSlices[z];
+            s.x.push_back(p.x), s.y.push_back(p.y), s.z.push_back(p.z), s.r2.push_back(sq(l.radius));
+            s.aIdxs.push_back(i);
+        }
+    }
+
+    /* negative radius never passes */
+    for (auto& s : this->aSlices)
+        while (s.x.size() % 4)
+            s.x.push_back(0), s.y.push_back(0), s.z.push_back(0), s.r2.push_back(-1.0f), s.aIdxs.push_back(0);
+
+    this->aGrid.resize(COUNT * 2);
+    if (pTp)
+    {
+        for (u32 z = 0; z < Z; z++)
+            pTp->submit([this, z]{ this->assignSlice(z); });
+        pTp->wait();
+    }
+    else
+    {
+        for (u32 z = 0; z < Z; z++)
+            this->assignSlice(z);
+    }
+
+    /* slice lists go one after another, clusters past the texture buffer limit lose lights */
+    this->aIndices.clear();
+    this->nDropped = 0;
+    for (u32 z = 0; z < Z; z++)
+    {
+        u32 base = this->aIndices.size();
+        for (u32 c = z * X * Y; c < (z + 1) * X * Y; c++)
+        {
+            u32& offset = this->aGrid[c * 2];
+            u32& count = this->aGrid[c * 2 + 1];
+            offset += base;
+
+            u32 fits = offset < this->maxIndices ? std::min(count, this->maxIndices - offset) : 0;
+            this->nDropped += count - fits;
+            count = fits;
+        }
+
+        auto& aOut = this->aSlices[z].aOut;
+        u32 n = std::min<u32>(aOut.size(), this->maxIndices - base);
+        this->aIndices.insert(this->aIndices.end(), aOut.begin(), aOut.begin() + n);
+    }
+
+    if (this->aIndices.empty())
+        this->aIndices.push_back(0);
+}
+
+/* sphere against each cluster box of the slice, 4 lights at a time */
+void
+LightClusters::assignSlice(u32 slice)
+{
+    auto& s = this->aSlices[slice];
+    s.aOut.clear();
+
+    for (u32 c = slice * X * Y; c < (slice + 1) * X * Y; c++)
+    {
+        const AABB& b = this->aBounds[c];
+        u32 first = s.aOut.size();
+        u32 i = 0;
+
+#ifdef __SSE2__
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 minX = _mm_set1_ps(b.min.x), minY = _mm_set1_ps(b.min.y), minZ = _mm_set1_ps(b.min.z);
+        const __m128 maxX = _mm_set1_ps(b.max.x), maxY = _mm_set1_ps(b.max.y), maxZ = _mm_set1_ps(b.max.z);
+
+        /* distance from the sphere center to the box along each axis, zero inside */
+        auto axis = [&](__m128 p, __m128 lo, __m128 hi) {
+            __m128 d = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lo, p), _mm_sub_ps(p, hi)), zero);
+            return _mm_mul_ps(d, d);
+        };
+
+        for (; i + 4 <= s.x.size(); i += 4)
+        {
+            __m128 d2 = _mm_add_ps(_mm_add_ps(axis(_mm_loadu_ps(&s.x[i]), minX, maxX), axis(_mm_loadu_ps(&s.y[i]), minY, maxY)),
+                                   axis(_mm_loadu_ps(&s.z[i]), minZ, maxZ));
+            int mask = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_loadu_ps(&s.r2[i])));
+
+            while (mask)
+            {
+                int bit = __builtin_ctz(mask);
+                s.aOut.push_back(s.aIdxs[i + bit]);
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; i < s.x.size(); i++)
+        {
+            auto axis = [](f32 p, f32 lo, f32 hi) { return sq(std::max({lo - p, p - hi, 0.0f})); };
+            f32 d2 = axis(s.x[i], b.min.x, b.max.x) + axis(s.y[i], b.min.y, b.max.y) + axis(s.z[i], b.min.z, b.max.z);
+            if (d2 <= s.r2[i])
+                s.aOut.push_back(s.aIdxs[i]);
+        }
+
+        this->aGrid[c * 2] = first;
+        this->aGrid[c * 2 + 1] = s.aOut.size() - first;
+    }
+}
+
+void
+LightClusters::upload()
+{
+    /* orphan, last frame's draws may still read the old storage */
+    glBindBuffer(GL_TEXTURE_BUFFER, this->gridBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, this->aGrid.size() * sizeof(u32), this->aGrid.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, this->indexBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, this->aIndices.size() * sizeof(u16), this->aIndices.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+
+#include "gl/gl.hh"
+#include "gmath.hh"
+#include "threadpool.hh"
+
+constexpr u32 MAX_POINT_LIGHTS = 512; /* 16 KiB as std140 array, the smallest GL_MAX_UNIFORM_BLOCK_SIZE */
+
+/* std140 element of the ubPointLights block */
+struct PointLight
+{
+    v3 pos;
+    f32 radius; /* no light beyond */
+    v3 color;
+    f32 shadow; /* ShadowAtlas slot + 1, 0 without shadow */
+};
+
+static_assert(sizeof(PointLight) == 32);
+
+/* view frustum split into X * Y screen tiles and Z exponential depth slices, each cluster gets the list of
+ * point lights whose range touches it. shaders find their cluster from gl_FragCoord and view depth, then read
+ * (offset, count) from the grid buffer and light indices from the index buffer. call gl functions with the
+ * context bound */
+struct LightClusters
+{
+    static constexpr u32 X = 16;
+    static constexpr u32 Y = 9;
+    static constexpr u32 Z = 24;
+    static constexpr u32 COUNT = X * Y * Z;
+    static constexpr f32 SLICE_NEAR = 0.1f; /* slices are spread from here, closer fragments use slice 0 */
+
+    std::vector<u32> aGrid; /* offset and count into aIndices per cluster, x fastest then y then z */
+    std::vector<u16> aIndices;
+    u32 nDropped = 0; /* light references that didn't fit into the index buffer in the last assign() */
+
+    GLuint gridBuffer = 0;
+    GLuint gridTex = 0; /* GL_RG32UI texture buffer */
+    GLuint indexBuffer = 0;
+    GLuint indexTex = 0; /* GL_R16UI texture buffer */
+
+    LightClusters() = default;
+    LightClusters(const LightClusters& other) = delete;
+    ~LightClusters();
+
+    LightClusters& operator=(const LightClusters& other) = delete;
+
+    void create();
+    void setProjection(f32 _fov, f32 _aspect, f32 _near, f32 _far); /* cluster bounds are rebuilt only if something changed */
+    void assign(const PointLight* pLights, u32 nLights, const m4& view, ThreadPool* pTp = nullptr); /* slices are split across the pool */
+    void upload();
+    v3 shaderScale(GLsizei width, GLsizei height) const; /* uClusterScale: gl_FragCoord.xy and log depth to cluster coords */
+    f32 shaderBias() const; /* uClusterBias */
+
+private:
+    std::vector<AABB> aBounds; /* view space */
+    u32 maxIndices = 65536; /* GL_MAX_TEXTURE_BUFFER_SIZE */
+    f32 fov = 0.0f, aspect = 0.0f, nearPlane = 0.0f, farPlane = 0.0f;
+
+    /* lights that overlap each slice in depth, padded to 4 for the simd test */
+    struct SliceLights
+    {
+        std::vector<f32> x, y, z, r2;
+        std::vector<u16> aIdxs;
+        std::vector<u16> aOut; /* light indices of the slice's clusters */
+    };
+
+    SliceLights aSlices[Z];
+
+    void assignSlice(u32 slice); /* writes slice local offsets into aGrid */
+};
@@ -1,6 +1,8 @@
 #include "controls.hh"
+#include "clusters.hh"
 #include "frame.hh"
 #include "utils.hh"
+#include <algorithm>
 #include <cmath>
 
 #ifdef __linux__
@@ -76,6 +78,70 @@ procKeysOnce(App* app, u32 key, u32 pressed)
             if (pressed) app->toggleVSync();
             break;
 
+        case KEY_G:
+            if (pressed)
+            {
+                shadowPath = static_cast<enum SHADOW_PATH>((static_cast<int>(shadowPath) + 1) % static_cast<int>(SHADOW_PATH::ESIZE));
+                LOG(OK, "shadow path: {}\n", shadowPath == SHADOW_PATH::GEOMETRY ? "geometry shader" : "per face");
+            }
+            break;
+
+        case KEY_K:
+            if (pressed)
+            {
+                shadowQuality = static_cast<enum SHADOW_QUALITY>((static_cast<int>(shadowQuality) + 1) % static_cast<int>(SHADOW_QUALITY::ESIZE));
+                LOG(OK, "shadow quality: {}\n", SHADOW_QUALITY_NAMES[static_cast<int>(shadowQuality)]);
+            }
+            break;
+
+        case KEY_L:
+            if (pressed)
+            {
+                bDeferred = !bDeferred;
+                LOG(OK, "shading: {}\n", bDeferred ? "deferred" : "forward");
+            }
+            break;
+
+        case KEY_N:
+            if (pressed)
+            {
+                bDynamicResolution = !bDynamicResolution;
+                LOG(OK, "dynamic resolution: {}\n", bDynamicResolution);
+            }
+            break;
+
+        case KEY_H:
+            if (pressed)
+            {
+                bDepthPrepass = !bDepthPrepass;
+                LOG(OK, "depth pre-pass: {}\n", bDepthPrepass);
+            }
+            break;
+
+        case KEY_EQUAL:
+            if (pressed)
+            {
+                nPointLights = std::min(nPointLights ? nPointLights * 2 : 1, MAX_POINT_LIGHTS);
+                LOG(OK, "point lights: {}\n", nPointLights);
+            }
+            break;
+
+        case KEY_MINUS:
+            if (pressed)
+            {
+                nPointLights /= 2;
+                LOG(OK, "point lights: {}\n", nPointLights);
+            }
+            break;
+
+        case KEY_J:
+            if (pressed)
+            {
+                bCountFragments = !bCountFragments;
+                LOG(OK, "count shaded fragments: {}\n", bCountFragments);
+            }
+            break;
+
         default:
             break;
     }
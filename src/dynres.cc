@@ -0,0 +1,100 @@
+#include "dynres.hh"
+
+#include <cmath>
+
+#include "utils.hh"
+
+DynamicResolution::~DynamicResolution()
+{
+    this->destroy();
+}
+
+void
+DynamicResolution::destroy()
+{
+    GLuint aRbs[] {this->colorRb, this->depthRb};
+    glDeleteRenderbuffers(std::size(aRbs), aRbs);
+    if (this->fbo)
+        glDeleteFramebuffers(1, &this->fbo);
+
+    this->fbo = this->colorRb = this->depthRb = 0;
+}
+
+void
+DynamicResolution::resize(int _width, int _height)
+{
+    if (_width == this->width && _height == this->height && this->fbo)
+        return;
+
+    this->destroy();
+    this->width = _width, this->height = _height;
+
+    glGenRenderbuffers(1, &this->colorRb);
+    glBindRenderbuffer(GL_RENDERBUFFER, this->colorRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, _width, _height);
+    glGenRenderbuffers(1, &this->depthRb);
+    glBindRenderbuffer(GL_RENDERBUFFER, this->depthRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, _width, _height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &this->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->colorRb);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthRb);
+
+    if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER))
+        LOG(FATAL, "glCheckFramebufferStatus != GL_FRAMEBUFFER_COMPLETE\n");
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gl::invalidateState();
+    LOG(OK, "dynamic resolution target: {}x{}\n", _width, _height);
+}
+
+void
+DynamicResolution::update(f64 frameMS)
+{
+    if (this->nSkip > 0)
+    {
+        this->nSkip--;
+        return;
+    }
+
+    this->aFrameMS[this->nFrames % NFRAMES] = frameMS;
+    if (++this->nFrames < NFRAMES)
+        return;
+
+    f64 sum = 0.0;
+    for (f64 ms : this->aFrameMS)
+        sum += ms;
+    this->avgMS = sum / NFRAMES;
+
+    /* pixel count goes with the square of the scale, so the scale that would hit the goal is sqrt of the ratio.
+     * the goal is the middle of the band, so a change lands inside it instead of on its edge.
+     * go down half way there as soon as the target is missed, go up a quarter of the way only below the band */
+    f32 goalMS = this->targetMS * (1.0f - HOLD_BAND * 0.5f);
+    f32 ratio = goalMS / this->avgMS;
+    f32 next = this->scale;
+    if (this->avgMS > this->targetMS)
+        next = this->scale * (1.0f + (std::sqrt(ratio) - 1.0f) * 0.5f);
+    else if (this->avgMS < this->targetMS * (1.0f - HOLD_BAND))
+        next = this->scale * (1.0f + (std::sqrt(ratio) - 1.0f) * 0.25f);
+
+    next = std::clamp(next, MIN_SCALE, MAX_SCALE);
+    if (next != this->scale)
+    {
+        /* wait for frames at the new scale before judging again */
+        this->scale = next;
+        this->nFrames = 0;
+        this->nSkip = gl::GpuTimer::NFRAMES;
+    }
+}
+
+void
+DynamicResolution::blit(GLuint dstFbo)
+{
+    /* the state cache only tracks GL_FRAMEBUFFER, put the read binding back after */
+    gl::bindFramebuffer(dstFbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, this->fbo);
+    glBlitFramebuffer(0, 0, this->renderWidth(), this->renderHeight(), 0, 0, this->width, this->height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, dstFbo);
+}
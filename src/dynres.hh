@@ -0,0 +1,46 @@
+#pragma once
+
+#include <algorithm>
+
+#include "gl/gl.hh"
+#include "ultratypes.h"
+
+/* offscreen color and depth at window size, of which only the top left scale * size part is rendered to
+ * and then stretched over the window. update() takes each frame's cost, without the vsync wait, and moves the scale
+ * towards whatever keeps it a little under targetMS, so resizing never reallocates. call gl functions with the context bound */
+struct DynamicResolution
+{
+    static constexpr f32 MIN_SCALE = 0.5f;
+    static constexpr f32 MAX_SCALE = 1.0f;
+    static constexpr u32 NFRAMES = 8; /* frame costs averaged, also the wait after each change */
+    static constexpr f32 HOLD_BAND = 0.15f; /* cost between (1 - band) * targetMS and targetMS keeps the scale */
+
+    GLuint fbo = 0;
+    GLuint colorRb = 0; /* GL_RGBA8 */
+    GLuint depthRb = 0; /* GL_DEPTH_COMPONENT24 */
+    int width = 0;
+    int height = 0;
+
+    f32 targetMS = 1000.0f / 60.0f; /* set to the refresh interval */
+    f32 scale = MAX_SCALE;
+    f64 avgMS = 0.0; /* over the last NFRAMES */
+
+    DynamicResolution() = default;
+    DynamicResolution(const DynamicResolution& other) = delete;
+    ~DynamicResolution();
+
+    DynamicResolution& operator=(const DynamicResolution& other) = delete;
+
+    void resize(int _width, int _height); /* recreates the buffers only if the window size changed */
+    void update(f64 frameMS); /* cpu or gpu time of the frame, whichever is longer */
+    int renderWidth() const { return std::max(static_cast<int>(this->width * this->scale), 1); }
+    int renderHeight() const { return std::max(static_cast<int>(this->height * this->scale), 1); }
+    void blit(GLuint dstFbo); /* the rendered part over the whole of dstFbo, which is window sized */
+
+private:
+    f64 aFrameMS[NFRAMES] {};
+    u32 nFrames = 0; /* since the last change */
+    u32 nSkip = 0; /* frames measured before the last change, gpu times come gl::GpuTimer::NFRAMES late */
+
+    void destroy();
+};
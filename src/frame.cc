@@ -1,9 +1,16 @@
 #include <cmath>
+#include <span>
 #include <thread>
 
 #include "frame.hh"
+#include "clusters.hh"
 #include "colors.hh"
+#include "dynres.hh"
+#include "gbuffer.hh"
 #include "model.hh"
+#include "renderqueue.hh"
+#include "rng.hh"
+#include "shadowatlas.hh"
 #include "threadpool.hh"
 
 #define SHADOW_WIDTH 1024
@@ -73,21 +80,84 @@ PlayerControls player {
 
 Shader shDebugDepthQuad;
 Shader shCubeDepth;
+Shader shCubeDepthFace;
 Shader shOmniDirShadow;
+Shader shOmniDirShadowCount; /* COUNT_FRAGMENTS variant */
+Shader shOmniDirShadowMoments; /* PREFILTERED_SHADOWS variant */
+Shader shMomentFilter;
+Shader shGBuffer;
+Shader shDeferred; /* DEFERRED_LIGHTING variant */
+Shader shDeferredMoments; /* DEFERRED_LIGHTING and PREFILTERED_SHADOWS */
+Shader shDepthPrepass;
 Shader shColor;
 Shader shTex;
 Shader shBF;
 Shader shNormalMapping;
+GpuHeap gpuHeap;
 Model mSphere;
 Model mSponza;
 Model mBackPack;
 Texture mBoxTex;
 Texture mDirtTex;
 Ubo uboProjView;
+UboRing uboDraws;
+RenderQueue renderQueue;
 CubeMap cmCubeMap;
+CubeMap aMomentMaps[2]; /* SHADOW_QUALITY::MOMENTS and MOMENTS_LOW */
+f32 momentExponent; /* as big as the moment format allows without overflowing the square */
+gl::GpuTimer shadowTimer;
+gl::GpuTimer filterTimer;
+gl::GpuTimer mainTimer;
+gl::AtomicCounter shadedFragments; /* binding 0 in omniDirShadow.frag */
+LightClusters lightClusters;
+Ubo uboPointLights;
+ShadowAtlas shadowAtlas;
+Ubo uboShadowAtlas;
+GBuffer gBuffer;
+DynamicResolution dynRes;
+f64 frameCpuMS = 0.0; /* drawFrame of the last frame, without the swap and its vsync wait */
+u32 aAtlasUpdates[ShadowAtlas::MAX_LIGHTS]; /* slots to render this frame */
+u32 nAtlasUpdates = 0;
+ThreadPool framePool(std::thread::hardware_concurrency()); /* per frame cpu work, like light clustering and node transforms */
+
+/* point lights wander around their own center */
+struct PointLightPath
+{
+    v3 center;
+    f32 orbit;
+    f32 speed;
+    f32 phase;
+};
+
+PointLight aPointLights[MAX_POINT_LIGHTS];
+PointLightPath aPointLightPaths[MAX_POINT_LIGHTS];
+
+/* no more than the depth bias of omniDirShadow.frag, so a cached depth is off by less than the bias */
+constexpr f32 SHADOW_CACHE_THRESHOLD = 0.02f; /* light movement that makes the cached faces stale */
+constexpr u32 SHADOW_CACHE_BUDGET = 2; /* back cube faces rendered per frame, round-robin */
+
+/* static geometry depth in two cubes. the front one is complete and all of it is rendered from one origin,
+ * the back one is filled a few faces per frame from its own frozen origin and becomes the front when done */
+struct ShadowCache
+{
+    CubeMap aCubes[2];
+    v3 aLightPos[2]; /* origin each cube is rendered from */
+    u32 front;
+    bool bFrontValid;
+    bool bBackActive; /* off while the light moves too fast for a refresh to be valid once it is done */
+    u32 nBackFaces; /* rendered into the back cube since its origin was frozen */
+    bool bUsed; /* front is within the threshold of the light, otherwise static models are drawn with the dynamic ones */
+    v3 prevLightPos;
+    u32 nUpdated; /* faces rendered in the last frame */
+};
+
+ShadowCache shadowCache;
 
 #ifdef FPS_COUNTER
 f64 _prevTime;
+f64 _cpuTimeMS;
+f64 _queueTimeMS; /* draw data upload and render queue building */
+f64 _clusterTimeMS; /* light to cluster assignment */
 #endif
 
 void
@@ -112,14 +182,55 @@ prepareDraw(App* app)
 
     shDebugDepthQuad.loadShaders("shaders/shadows/debugQuad.vert", "shaders/shadows/debugQuad.frag");
     shCubeDepth.loadShaders("shaders/shadows/cubeMap/cubeMapDepth.vert", "shaders/shadows/cubeMap/cubeMapDepth.geom", "shaders/shadows/cubeMap/cubeMapDepth.frag");
+    shCubeDepthFace.loadShaders("shaders/shadows/cubeMap/cubeMapDepthFace.vert", "shaders/shadows/cubeMap/cubeMapDepth.frag");
     shOmniDirShadow.loadShaders("shaders/shadows/cubeMap/omniDirShadow.vert", "shaders/shadows/cubeMap/omniDirShadow.frag");
+    shOmniDirShadowMoments.loadShaders("shaders/shadows/cubeMap/omniDirShadow.vert", "shaders/shadows/cubeMap/omniDirShadow.frag", {"PREFILTERED_SHADOWS"});
+    shMomentFilter.loadShaders("shaders/fullscreen.vert", "shaders/shadows/cubeMap/momentFilter.frag");
+    shGBuffer.loadShaders("shaders/shadows/cubeMap/omniDirShadow.vert", "shaders/gbuffer.frag");
+    shDeferred.loadShaders("shaders/fullscreen.vert", "shaders/shadows/cubeMap/omniDirShadow.frag", {"DEFERRED_LIGHTING"});
+    shDeferredMoments.loadShaders("shaders/fullscreen.vert", "shaders/shadows/cubeMap/omniDirShadow.frag", {"DEFERRED_LIGHTING", "PREFILTERED_SHADOWS"});
+    shDepthPrepass.loadShaders("shaders/depthPrepass.vert", "shaders/depthPrepass.frag");
     shColor.loadShaders("shaders/simple.vert", "shaders/simple.frag");
     shTex.loadShaders("shaders/simpleTex.vert", "shaders/simpleTex.frag");
     shNormalMapping.loadShaders("shaders/normalMapping.vert", "shaders/normalMapping.frag");
 
     shOmniDirShadow.use();
     shOmniDirShadow.setI("uDiffuseTexture", 0);
-    shOmniDirShadow.setI("uDepthMap", 1);
+
+    /* 32 bit floats aren't always filterable, half floats overflow past exp(11) */
+    bool bFloatLinear = gl::hasExtension("GL_OES_texture_float_linear");
+    GLenum momentFormat = bFloatLinear ? GL_RG32F : GL_RG16F;
+    momentExponent = bFloatLinear ? 40.0f : 5.54f;
+
+    shMomentFilter.use();
+    shMomentFilter.setI("uDepthMap", 1);
+    shMomentFilter.setF("uTexel", 2.0f / SHADOW_WIDTH);
+    shMomentFilter.setF("uExponent", momentExponent);
+
+    /* the counting variant doesn't compile without fragment atomic counters */
+    shadedFragments.create(0);
+    if (shadedFragments.bSupported)
+        shOmniDirShadowCount.loadShaders("shaders/shadows/cubeMap/omniDirShadow.vert", "shaders/shadows/cubeMap/omniDirShadow.frag", {"COUNT_FRAGMENTS"});
+
+    /* forward and deferred variants of the lighting shader share textures units and blocks */
+    Shader* aLitShaders[] {&shOmniDirShadow, &shOmniDirShadowCount, &shOmniDirShadowMoments, &shDeferred, &shDeferredMoments};
+    for (Shader* sh : aLitShaders)
+    {
+        if (!sh->id)
+            continue;
+
+        sh->use();
+        sh->setI("uDepthMap", 1);
+        sh->setI("uClusterGrid", 2);
+        sh->setI("uClusterLights", 3);
+        sh->setI("uShadowAtlas", 4);
+        sh->setI("uMomentMap", 5);
+        sh->setI("uGAlbedo", 6);
+        sh->setI("uGNormal", 7);
+        sh->setI("uGDepth", 8);
+        sh->setF("uMomentExponent", momentExponent);
+        sh->setV3("uClusterDims", {LightClusters::X, LightClusters::Y, LightClusters::Z});
+    }
 
     shNormalMapping.use();
     shNormalMapping.setI("uDiffuseTex", 0);
@@ -129,12 +240,48 @@ prepareDraw(App* app)
     shDebugDepthQuad.setI("uDepthMap", 1);
 
     cmCubeMap = createCubeShadowMap(SHADOW_WIDTH, SHADOW_HEIGHT);
+    for (CubeMap& cube : shadowCache.aCubes)
+        cube = createCubeShadowMap(SHADOW_WIDTH, SHADOW_HEIGHT);
+    aMomentMaps[0] = createCubeMomentMap(SHADOW_WIDTH / 2, SHADOW_HEIGHT / 2, momentFormat);
+    aMomentMaps[1] = createCubeMomentMap(SHADOW_WIDTH / 4, SHADOW_HEIGHT / 4, momentFormat);
 
     uboProjView.createBuffer(sizeof(m4) * 2, GL_DYNAMIC_DRAW);
-    uboProjView.bindBlock(&shOmniDirShadow, "ubProjView", 0);
-    uboProjView.bindBlock(&shColor, "ubProjView", 0);
-    uboProjView.bindBlock(&shTex, "ubProjView", 0);
-    uboProjView.bindBlock(&shNormalMapping, "ubProjView", 0);
+    uboProjView.bindBlock(&shColor, "ubProjView", PROJ_VIEW_UBO_POINT);
+    uboProjView.bindBlock(&shTex, "ubProjView", PROJ_VIEW_UBO_POINT);
+    uboProjView.bindBlock(&shNormalMapping, "ubProjView", PROJ_VIEW_UBO_POINT);
+    uboProjView.bindBlock(&shDepthPrepass, "ubProjView", PROJ_VIEW_UBO_POINT);
+    uboProjView.bindBlock(&shGBuffer, "ubProjView", PROJ_VIEW_UBO_POINT);
+
+    shadowTimer.create();
+    filterTimer.create();
+    mainTimer.create();
+
+    lightClusters.create();
+    uboPointLights.createBuffer(sizeof(aPointLights), GL_DYNAMIC_DRAW);
+
+    shadowAtlas.create();
+    uboShadowAtlas.createBuffer(sizeof(shadowAtlas.aShadows), GL_DYNAMIC_DRAW);
+
+    for (Shader* sh : aLitShaders)
+    {
+        if (!sh->id)
+            continue;
+
+        uboProjView.bindBlock(sh, "ubProjView", PROJ_VIEW_UBO_POINT);
+        uboPointLights.bindBlock(sh, "ubPointLights", POINT_LIGHTS_UBO_POINT);
+        uboShadowAtlas.bindBlock(sh, "ubShadowAtlas", SHADOW_ATLAS_UBO_POINT);
+    }
+
+    for (auto& p : aPointLightPaths)
+        p = {{rng::get(-10.0f, 10.0f), rng::get(0.3f, 6.0f), rng::get(-4.0f, 4.0f)}, rng::get(0.2f, 2.0f), rng::get(0.2f, 1.0f), rng::get(0.0f, 2.0f * static_cast<f32>(PI))};
+    for (auto& l : aPointLights)
+        l = {.pos {}, .radius = rng::get(1.0f, 3.0f), .color = v3Norm({rng::get(0.1f, 1.0f), rng::get(0.1f, 1.0f), rng::get(0.1f, 1.0f)}), .shadow = 0};
+
+    uboDraws.createBuffer(sizeof(DrawData) * 256);
+    for (Shader* sh : {&shCubeDepth, &shCubeDepthFace, &shOmniDirShadow, &shOmniDirShadowMoments, &shGBuffer, &shDepthPrepass, &shColor, &shTex, &shNormalMapping})
+        uboDraws.bindBlock(sh, "ubDraw", DRAW_UBO_POINT);
+    if (shadedFragments.bSupported)
+        uboDraws.bindBlock(&shOmniDirShadowCount, "ubDraw", DRAW_UBO_POINT);
 
     /* unbind before creating threads */
     app->unbindGlContext();
@@ -142,31 +289,170 @@ prepareDraw(App* app)
     ThreadPool tp(std::thread::hardware_concurrency());
 
     tp.submit([&]{ mSphere.load("test-assets/models/icosphere/obj/icosphere.obj", GL_STATIC_DRAW, GL_MIRRORED_REPEAT, app); });
-    tp.submit([&]{ mSponza.load("test-assets/models/Sponza/Sponza.gltf", GL_STATIC_DRAW, GL_MIRRORED_REPEAT, app); });
-    tp.submit([&]{ mBackPack.load("test-assets/models/backpack/scene.gltf", GL_STATIC_DRAW, GL_MIRRORED_REPEAT, app); });
+    tp.submit([&]{ mSponza.load("test-assets/models/Sponza/Sponza.gltf", GL_STATIC_DRAW, GL_MIRRORED_REPEAT, app, LOAD::QUANTIZE | LOAD::STATIC_BATCH); });
+    tp.submit([&]{ mBackPack.load("test-assets/models/backpack/scene.gltf", GL_STATIC_DRAW, GL_MIRRORED_REPEAT, app, LOAD::QUANTIZE); });
     tp.wait();
 
     /* restore context after assets are loaded */
     app->bindGlContext();
+
+    /* loading only appends, drop the slack left by pool growth */
+    gpuHeap.logStats("after loading");
+    gpuHeap.defragment();
+    gpuHeap.logStats("after defragment");
+
+    setInstanceAttribDefaults();
+
+    /* loaders bound their own objects */
+    gl::invalidateState();
 }
 
 f64 incCounter = 0;
+enum SHADOW_PATH shadowPath = SHADOW_PATH::GEOMETRY;
+enum SHADOW_QUALITY shadowQuality = SHADOW_QUALITY::PCF;
+bool bDepthPrepass = false;
+bool bDeferred = false;
+bool bDynamicResolution = false;
+u32 nPointLights = 0;
+bool bCountFragments = false;
 f32 fov = 90.0f;
 f64 x = 0.0, y = 0.0, z = 0.0;
 
+/* visible/culled primitives and submitted triangles of the last frame */
+struct PassStats
+{
+    u64 visible;
+    u64 culled;
+    u64 triangles;
+};
+
+PassStats shadowPassStats;
+PassStats prepassStats;
+PassStats mainPassStats;
+
+/* static models never move, so their shadows are rendered into a cached cube that the dynamic ones are drawn over each frame */
+Model* aStaticModels[] {&mSponza};
+Model* aDynamicModels[] {&mBackPack};
+
+/* swaps in a finished back cube, then picks up to SHADOW_CACHE_BUDGET back cube faces for this frame, returns their count */
+static u32
+scheduleShadowCache(const v3& lightPos, u32* pFaces)
+{
+    auto& c = shadowCache;
+
+    if (c.bBackActive && c.nBackFaces == 6)
+    {
+        c.front ^= 1;
+        c.bFrontValid = true;
+        c.bBackActive = false;
+    }
+
+    /* a refresh takes this many frames, if the light moves past the threshold meanwhile it is stale once done */
+    constexpr u32 refreshFrames = (6 + SHADOW_CACHE_BUDGET - 1) / SHADOW_CACHE_BUDGET + 1;
+    bool bFast = v3Length(lightPos - c.prevLightPos) * refreshFrames > SHADOW_CACHE_THRESHOLD;
+    c.prevLightPos = lightPos;
+
+    u32 back = c.front ^ 1;
+    if (bFast)
+        c.bBackActive = false;
+    else if (!c.bBackActive && (!c.bFrontValid || v3Length(lightPos - c.aLightPos[c.front]) > SHADOW_CACHE_THRESHOLD))
+    {
+        c.aLightPos[back] = lightPos;
+        c.nBackFaces = 0;
+        c.bBackActive = true;
+    }
+
+    u32 n = 0;
+    if (c.bBackActive)
+    {
+        for (; n < SHADOW_CACHE_BUDGET && c.nBackFaces < 6; n++)
+            pFaces[n] = c.nBackFaces++;
+    }
+
+    c.bUsed = c.bFrontValid && v3Length(lightPos - c.aLightPos[c.front]) <= SHADOW_CACHE_THRESHOLD;
+    c.nUpdated = n;
+    return n;
+}
+
+/* moves the lights and sorts them into the clusters of this frame's view */
 static void
-renderScene(Shader* sh, bool depth)
+prepareLights(f32 aspect, f32 nearPlane, f32 farPlane)
 {
-    m4 m = m4Iden();
+    f32 t = player.currTime;
+    for (u32 i = 0; i < nPointLights; i++)
+    {
+        auto& p = aPointLightPaths[i];
+        f32 a = p.phase + t * p.speed;
+        aPointLights[i].pos = p.center + v3(std::cos(a) * p.orbit, std::sin(a * 0.7f) * p.orbit * 0.5f, std::sin(a) * p.orbit);
+    }
+
+    /* shadow field of the lights is set here */
+    Frustum viewFrustum = frustumFromTm(player.proj * player.view);
+    nAtlasUpdates = shadowAtlas.schedule(aPointLights, nPointLights, viewFrustum, player.pos, toRad(fov), aAtlasUpdates, std::size(aAtlasUpdates));
+    uboShadowAtlas.bufferData(shadowAtlas.aShadows, 0, sizeof(shadowAtlas.aShadows));
+
+#ifdef FPS_COUNTER
+    f64 _clusterStart = timeNowMS();
+#endif
+    lightClusters.setProjection(toRad(fov), aspect, nearPlane, farPlane);
+    lightClusters.assign(aPointLights, nPointLights, player.view, &framePool);
+#ifdef FPS_COUNTER
+    _clusterTimeMS += timeNowMS() - _clusterStart;
+#endif
+
+    lightClusters.upload();
+    if (nPointLights > 0)
+        uboPointLights.bufferData(aPointLights, 0, sizeof(PointLight) * nPointLights);
+}
+
+/* per draw data of every model for this frame, shared by all passes */
+static void
+prepareScene(const m4& tmLightSource)
+{
+    uboDraws.beginFrame();
 
-    enum DRAW nm = depth ? DRAW::NONE : DRAW::APPLY_NM;
-    mSponza.drawGraph(DRAW::DIFF | DRAW::APPLY_TM | nm, sh, "uModel", "uNormalMatrix", m);
+    mSponza.prepareDrawGraph(&uboDraws, m4Iden(), &framePool);
 
-    m = m4Iden();
+    m4 m = m4Iden();
     m *= m4Translate(m, {0, 0.5, 0});
     m *= m4Scale(m, 0.002);
     m = m4RotY(m, toRad(90));
-    mBackPack.drawGraph(DRAW::DIFF | DRAW::APPLY_TM | nm, sh, "uModel", "uNormalMatrix", m);
+    mBackPack.prepareDrawGraph(&uboDraws, m, &framePool);
+
+    mSphere.prepareDraw(&uboDraws, tmLightSource);
+
+    uboDraws.upload();
+}
+
+/* render queue pass ids, in submit order */
+constexpr u32 STATIC_SHADOW_PASS = 0; /* + cube face, only the faces updated this frame */
+constexpr u32 SHADOW_PASS = 6; /* + cube face */
+constexpr u32 DEPTH_PREPASS = 12; /* only with bDepthPrepass */
+constexpr u32 MAIN_PASS = 13; /* opaque meshes, or every mesh into the gbuffer */
+constexpr u32 MAIN_LATE_PASS = 14; /* alpha tested meshes, which the pre-pass leaves out, and the light */
+constexpr u32 ATLAS_PASS = 16; /* + atlas update * 6 + cube face */
+
+static_assert(ATLAS_PASS + ShadowAtlas::MAX_LIGHTS * 6 <= 256);
+
+/* point light cube faces are rendered with a 90 degree frustum from near to the light's range */
+static CubeMapProjections
+atlasProjections(u32 slot)
+{
+    auto& s = shadowAtlas.aShadows[slot];
+    return CubeMapProjections(m4Pers(toRad(90), 1.0f, 0.01f, s.farPlane), s.pos);
+}
+
+static void
+queueScene(std::span<Model* const> aModels, const RenderPass& pass, PassStats* pStats)
+{
+    u64 visible = drawStats.visible;
+    u64 culled = drawStats.culled;
+
+    for (Model* m : aModels)
+        m->queueDraw(&renderQueue, pass);
+
+    pStats->visible += drawStats.visible - visible;
+    pStats->culled += drawStats.culled - culled;
 }
 
 static void
@@ -178,15 +464,35 @@ drawFrame(App* app)
 
     f32 aspect = static_cast<f32>(app->wWidth) / static_cast<f32>(app->wHeight);
     constexpr f32 shadowAspect = static_cast<f32>(SHADOW_WIDTH) / static_cast<f32>(SHADOW_HEIGHT);
+    constexpr f32 viewFarPlane = 100.0f;
 
     if (!app->bPaused)
     {
+        f64 cpuStart = timeNowMS();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        player.updateProj(toRad(fov), aspect, 0.01f, 100.0f);
+        /* main passes go to the offscreen target at the scale picked from the recent frame costs.
+         * cpu and gpu overlap, so the cost is the longer of the two, the gpu one being the sum of the timed scene passes */
+        GLuint sceneFbo = 0;
+        int renderWidth = app->wWidth, renderHeight = app->wHeight;
+        if (bDynamicResolution)
+        {
+            f64 gpuMS = shadowTimer.lastMS + mainTimer.lastMS;
+            if (shadowQuality != SHADOW_QUALITY::PCF)
+                gpuMS += filterTimer.lastMS;
+
+            dynRes.targetMS = static_cast<f32>(1000.0 * std::max(app->swapInterval, 1) / app->refreshRate);
+            dynRes.resize(app->wWidth, app->wHeight);
+            dynRes.update(std::max(frameCpuMS, gpuMS));
+            sceneFbo = dynRes.fbo;
+            renderWidth = dynRes.renderWidth(), renderHeight = dynRes.renderHeight();
+        }
+
+        player.updateProj(toRad(fov), aspect, 0.01f, viewFarPlane);
         player.updateView();
         /* copy both proj and view in one go */
         uboProjView.bufferData(&player, 0, sizeof(m4) * 2);
+        prepareLights(aspect, 0.01f, viewFarPlane);
 
         // v3 lightPos {x, 4, -1};
         v3 lightPos {std::cosf(player.currTime) * 6.0f, 3, std::sinf(player.currTime) * 1.1f};
@@ -195,44 +501,282 @@ drawFrame(App* app)
         m4 shadowProj = m4Pers(toRad(90), shadowAspect, nearPlane, farPlane);
         CubeMapProjections shadowTms(shadowProj, lightPos);
 
-        /* render scene to depth cubemap */
-        glViewport(0, 0, cmCubeMap.width, cmCubeMap.height);
-        glBindFramebuffer(GL_FRAMEBUFFER, cmCubeMap.fbo);
-        glClear(GL_DEPTH_BUFFER_BIT);
-
-        shCubeDepth.use();
-        for (size_t i = 0; i < std::size(shadowTms.tms); i++)
-            shCubeDepth.setM4(FMT("uShadowMatrices[{}]", i), shadowTms[i]);
-        shCubeDepth.setV3("uLightPos", lightPos);
-        shCubeDepth.setF("uFarPlane", farPlane);
-        glActiveTexture(GL_TEXTURE1);
-        glCullFace(GL_FRONT);
-        renderScene(&shCubeDepth, true);
-        glCullFace(GL_BACK);
+        m4 tmCube = m4Iden();
+        tmCube = m4Translate(tmCube, lightPos);
+        tmCube = m4Scale(tmCube, 0.05f);
+#ifdef FPS_COUNTER
+        f64 _queueStart = timeNowMS();
+#endif
+        prepareScene(tmCube);
+
+        u32 aCacheFaces[6];
+        u32 nCacheFaces = scheduleShadowCache(lightPos, aCacheFaces);
+        CubeMap& cacheBack = shadowCache.aCubes[shadowCache.front ^ 1];
+        const v3& cacheBackPos = shadowCache.aLightPos[shadowCache.front ^ 1];
+        CubeMapProjections cacheTms(shadowProj, cacheBackPos);
+
+        /* each cube face gets only what is inside of both its frustum and the light's range */
+        Frustum aFaceFrusta[6], aCacheFrusta[6];
+        for (int f = 0; f < 6; f++)
+        {
+            aFaceFrusta[f] = frustumFromTm(shadowTms[f]);
+            aCacheFrusta[f] = frustumFromTm(cacheTms[f]);
+        }
+        Frustum viewFrustum = frustumFromTm(player.proj * player.view);
+
+        /* with the pre-pass, depth is resolved before shading and the main pass can sort by state instead */
+        /* the counting variant filters with pcf only */
+        bool bPrefiltered = shadowQuality != SHADOW_QUALITY::PCF;
+        bool bCount = bCountFragments && shadedFragments.bSupported;
+        Shader* pShLit = bPrefiltered ? &shOmniDirShadowMoments : &shOmniDirShadow;
+        Shader* pShMain = bCount ? &shOmniDirShadowCount : pShLit;
+        Shader* pShDeferred = bPrefiltered ? &shDeferredMoments : &shDeferred;
+        RenderPass prepass {DEPTH_PREPASS, &shDepthPrepass, DRAW::APPLY_TM | DRAW::DEPTH | DRAW::SKIP_ALPHA_TEST, &viewFrustum, player.pos, viewFarPlane, SORT::FRONT_TO_BACK};
+        RenderPass mainPass {MAIN_PASS, pShMain, DRAW::DIFF | DRAW::APPLY_TM | DRAW::SKIP_ALPHA_TEST, &viewFrustum, player.pos, viewFarPlane,
+                             bDepthPrepass ? SORT::STATE : SORT::FRONT_TO_BACK};
+        RenderPass alphaTestPass {MAIN_LATE_PASS, pShLit, DRAW::DIFF | DRAW::APPLY_TM | DRAW::ONLY_ALPHA_TEST, &viewFrustum, player.pos, viewFarPlane, SORT::FRONT_TO_BACK};
+        RenderPass gbufferPass {MAIN_PASS, &shGBuffer, DRAW::DIFF | DRAW::APPLY_TM, &viewFrustum, player.pos, viewFarPlane, SORT::FRONT_TO_BACK};
+        RenderPass lightPass {MAIN_LATE_PASS, &shColor, DRAW::APPLY_TM, nullptr, player.pos, viewFarPlane, SORT::FRONT_TO_BACK};
+
+        bool bPerFace = shadowPath == SHADOW_PATH::PER_FACE;
+        Shader* pShDepth = bPerFace ? &shCubeDepthFace : &shCubeDepth;
+
+        shadowPassStats = {};
+        prepassStats = {};
+        mainPassStats = {};
+        renderQueue.clear();
+        for (u32 i = 0; i < nCacheFaces; i++)
+        {
+            u32 f = aCacheFaces[i];
+            RenderPass cachePass {STATIC_SHADOW_PASS + f, &shCubeDepthFace, DRAW::APPLY_TM | DRAW::DEPTH, &aCacheFrusta[f], cacheBackPos, farPlane, SORT::STATE, farPlane};
+            queueScene(aStaticModels, cachePass, &shadowPassStats);
+        }
+        for (u32 f = 0; f < 6; f++)
+        {
+            /* depth shader doesn't sample textures, so shadow draws only switch position only vertex arrays */
+            RenderPass facePass {SHADOW_PASS + f, pShDepth, DRAW::APPLY_TM | DRAW::DEPTH, &aFaceFrusta[f], lightPos, farPlane, SORT::STATE, farPlane};
+            if (!shadowCache.bUsed)
+                queueScene(aStaticModels, facePass, &shadowPassStats);
+            queueScene(aDynamicModels, facePass, &shadowPassStats);
+        }
+        for (u32 i = 0; i < nAtlasUpdates; i++)
+        {
+            auto& s = shadowAtlas.aShadows[aAtlasUpdates[i]];
+            CubeMapProjections tms = atlasProjections(aAtlasUpdates[i]);
+            for (u32 f = 0; f < 6; f++)
+            {
+                Frustum frustum = frustumFromTm(tms[f]);
+                RenderPass atlasPass {ATLAS_PASS + i * 6 + f, &shCubeDepthFace, DRAW::APPLY_TM | DRAW::DEPTH, &frustum, s.pos, s.farPlane, SORT::STATE, s.farPlane};
+                queueScene(aStaticModels, atlasPass, &shadowPassStats);
+                queueScene(aDynamicModels, atlasPass, &shadowPassStats);
+            }
+        }
+        if (bDeferred)
+        {
+            /* gbuffer writes are cheap, so no pre-pass and alpha tested meshes go in the same pass */
+            queueScene(aStaticModels, gbufferPass, &mainPassStats);
+            queueScene(aDynamicModels, gbufferPass, &mainPassStats);
+        }
+        else
+        {
+            if (bDepthPrepass)
+            {
+                queueScene(aStaticModels, prepass, &prepassStats);
+                queueScene(aDynamicModels, prepass, &prepassStats);
+            }
+            for (auto* pPass : {&mainPass, &alphaTestPass})
+            {
+                queueScene(aStaticModels, *pPass, &mainPassStats);
+                queueScene(aDynamicModels, *pPass, &mainPassStats);
+            }
+        }
+        mSphere.queueDraw(&renderQueue, lightPass);
+        renderQueue.prepare();
+#ifdef FPS_COUNTER
+        _queueTimeMS += timeNowMS() - _queueStart;
+#endif
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        gl::viewport(0, 0, cmCubeMap.width, cmCubeMap.height);
+        gl::cullFace(GL_FRONT);
+        shadowTimer.begin();
+        u64 triangles = drawStats.triangles;
+
+        /* next faces of the back cube */
+        if (nCacheFaces > 0)
+        {
+            shCubeDepthFace.use();
+            shCubeDepthFace.setV3("uLightPos", cacheBackPos);
+            shCubeDepthFace.setF("uFarPlane", farPlane);
+            for (u32 i = 0; i < nCacheFaces; i++)
+            {
+                u32 f = aCacheFaces[i];
+                gl::bindFramebuffer(cacheBack.aFaceFbos[f]);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                shCubeDepthFace.setM4("uShadowMatrix", cacheTms[f]);
+                renderQueue.submit(STATIC_SHADOW_PASS + f);
+            }
+        }
+
+        /* start from the static depth and draw dynamic models over it,
+         * or draw both from the light's position when the cache can't keep up with it */
+        if (shadowCache.bUsed)
+        {
+            glCopyImageSubData(shadowCache.aCubes[shadowCache.front].tex, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0,
+                               cmCubeMap.tex, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0,
+                               cmCubeMap.width, cmCubeMap.height, 6);
+            gl::bindFramebuffer(cmCubeMap.fbo);
+        }
+        else
+        {
+            gl::bindFramebuffer(cmCubeMap.fbo);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+
+        pShDepth->use();
+        pShDepth->setV3("uLightPos", lightPos);
+        pShDepth->setF("uFarPlane", farPlane);
+        if (!bPerFace)
+            shCubeDepth.setM4("uShadowMatrices", shadowTms.tms, std::size(shadowTms.tms));
+        for (int f = 0; f < 6; f++)
+        {
+            if (bPerFace)
+            {
+                gl::bindFramebuffer(cmCubeMap.aFaceFbos[f]);
+                shCubeDepthFace.setM4("uShadowMatrix", shadowTms[f]);
+            }
+            else shCubeDepth.setI("uFace", f);
+
+            renderQueue.submit(SHADOW_PASS + f);
+        }
+
+        /* point light blocks due this frame, scissor keeps the clears inside of each face */
+        if (nAtlasUpdates > 0)
+        {
+            gl::bindFramebuffer(shadowAtlas.fbo);
+            gl::enable(GL_SCISSOR_TEST);
+            shCubeDepthFace.use();
+            for (u32 i = 0; i < nAtlasUpdates; i++)
+            {
+                u32 slot = aAtlasUpdates[i];
+                GLsizei size = shadowAtlas.faceSize(slot);
+                CubeMapProjections tms = atlasProjections(slot);
+                shCubeDepthFace.setV3("uLightPos", shadowAtlas.aShadows[slot].pos);
+                shCubeDepthFace.setF("uFarPlane", shadowAtlas.aShadows[slot].farPlane);
+
+                for (u32 f = 0; f < 6; f++)
+                {
+                    GLint x, y;
+                    shadowAtlas.faceViewport(slot, f, &x, &y);
+                    gl::viewport(x, y, size, size);
+                    glScissor(x, y, size, size);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+                    shCubeDepthFace.setM4("uShadowMatrix", tms[f]);
+                    renderQueue.submit(ATLAS_PASS + i * 6 + f);
+                }
+            }
+            gl::disable(GL_SCISSOR_TEST);
+        }
+        shadowPassStats.triangles = drawStats.triangles - triangles;
+        shadowTimer.end();
+        gl::cullFace(GL_BACK);
+
+        /* blur the finished depth cube once instead of taking 20 taps for every shaded fragment */
+        CubeMap& moments = aMomentMaps[shadowQuality == SHADOW_QUALITY::MOMENTS ? 0 : 1];
+        if (bPrefiltered)
+        {
+            filterTimer.begin();
+            gl::disable(GL_DEPTH_TEST);
+            gl::disable(GL_BLEND);
+            gl::viewport(0, 0, moments.width, moments.height);
+            gl::bindTexture(GL_TEXTURE1, GL_TEXTURE_CUBE_MAP, cmCubeMap.tex);
+            gl::bindVertexArray(0);
+            shMomentFilter.use();
+            shMomentFilter.setF("uSize", moments.width);
+            for (int f = 0; f < 6; f++)
+            {
+                gl::bindFramebuffer(moments.aFaceFbos[f]);
+                shMomentFilter.setI("uFace", f);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+            }
+            gl::enable(GL_BLEND);
+            gl::enable(GL_DEPTH_TEST);
+            filterTimer.end();
+        }
+
+        gl::bindFramebuffer(sceneFbo);
 
         /* reset viewport */
-        glViewport(0, 0, app->wWidth, app->wHeight);
+        gl::viewport(0, 0, renderWidth, renderHeight);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        if (bDepthPrepass && !bDeferred)
+        {
+            gl::colorMask(GL_FALSE);
+            triangles = drawStats.triangles;
+            renderQueue.submit(DEPTH_PREPASS);
+            prepassStats.triangles = drawStats.triangles - triangles;
+            gl::colorMask(GL_TRUE);
+
+            /* shade only what the pre-pass left in the depth buffer */
+            gl::depthFunc(GL_EQUAL);
+            gl::depthMask(GL_FALSE);
+        }
+
         /*render scene as normal using the denerated depth map */
-        shOmniDirShadow.use();
-        shOmniDirShadow.setV3("uLightPos", lightPos);
-        shOmniDirShadow.setV3("uLightColor", lightColor);
-        shOmniDirShadow.setV3("uViewPos", player.pos);
-        shOmniDirShadow.setF("uFarPlane", farPlane);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cmCubeMap.tex);
-        renderScene(&shOmniDirShadow, false);
-
-        /* draw light source */
-        m4 tmCube = m4Iden();
-        tmCube = m4Translate(tmCube, lightPos);
-        tmCube = m4Scale(tmCube, 0.05f);
+        mainTimer.begin();
+        for (Shader* sh : {pShMain, pShLit, pShDeferred})
+        {
+            sh->use();
+            sh->setV3("uLightPos", lightPos);
+            sh->setV3("uLightColor", lightColor);
+            sh->setV3("uViewPos", player.pos);
+            sh->setF("uFarPlane", farPlane);
+            sh->setV3("uClusterScale", lightClusters.shaderScale(renderWidth, renderHeight));
+            sh->setF("uClusterBias", lightClusters.shaderBias());
+        }
+        gl::bindTexture(GL_TEXTURE1, GL_TEXTURE_CUBE_MAP, cmCubeMap.tex);
+        gl::bindTexture(GL_TEXTURE2, GL_TEXTURE_BUFFER, lightClusters.gridTex);
+        gl::bindTexture(GL_TEXTURE3, GL_TEXTURE_BUFFER, lightClusters.indexTex);
+        gl::bindTexture(GL_TEXTURE4, GL_TEXTURE_2D, shadowAtlas.tex);
+        if (bPrefiltered)
+            gl::bindTexture(GL_TEXTURE5, GL_TEXTURE_CUBE_MAP, moments.tex);
+
+        /* light source is in the late pass with its own program */
         shColor.use();
         shColor.setV3("uColor", lightColor);
-        mSphere.draw(DRAW::APPLY_TM, &shColor, "uModel", "", tmCube);
+        triangles = drawStats.triangles;
+        if (bDeferred)
+        {
+            gBuffer.resize(app->wWidth, app->wHeight);
+            gl::bindFramebuffer(gBuffer.fbo);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            renderQueue.submit(MAIN_PASS);
+            gl::bindFramebuffer(sceneFbo);
+
+            /* every pixel is lit once, the lighting pass also writes the gbuffer depth back for the light source */
+            gl::bindTexture(GL_TEXTURE6, GL_TEXTURE_2D, gBuffer.albedoTex);
+            gl::bindTexture(GL_TEXTURE7, GL_TEXTURE_2D, gBuffer.normalTex);
+            gl::bindTexture(GL_TEXTURE8, GL_TEXTURE_2D, gBuffer.depthTex);
+            pShDeferred->use();
+            pShDeferred->setM4("uInvProjView", m4Inverse(player.proj * player.view));
+            pShDeferred->setV2("uInvRenderSize", {1.0f / renderWidth, 1.0f / renderHeight});
+            gl::depthFunc(GL_ALWAYS);
+            gl::bindVertexArray(0);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        else renderQueue.submit(MAIN_PASS);
+
+        gl::depthFunc(GL_LESS);
+        gl::depthMask(GL_TRUE);
+        renderQueue.submit(MAIN_LATE_PASS);
+        mainPassStats.triangles = drawStats.triangles - triangles;
+        mainTimer.end();
+
+        if (bDynamicResolution)
+            dynRes.blit(0);
+
+        uboDraws.endFrame();
+        frameCpuMS = timeNowMS() - cpuStart;
 
         incCounter += 1.0 * player.deltaTime;
     }
@@ -261,15 +805,48 @@ run(App* app)
     f64 _currTime = timeNowS();
     if (_currTime >= _prevTime + 1.0)
     {
-        CERR("fps: {}, ms: {:.3f}\n", _fpsCount, player.deltaTime);
+        CERR("fps: {}, ms: {:.3f}, cpu ms: {:.3f} (queue {:.3f}), draw calls: {} (saved: {}), instances: {}, visible/culled: shadow {}/{}, main {}/{}, shadow cache faces updated: {} (in use: {}), triangles: shadow {} (gpu ms: {:.3f}), main {}, gl state calls issued/filtered: {}/{}, queue changes program/texture/vao: {}/{}/{}\n",
+             _fpsCount, player.deltaTime, _cpuTimeMS / _fpsCount, _queueTimeMS / _fpsCount, drawStats.drawCalls, drawStats.drawCallsSaved, drawStats.instances,
+             shadowPassStats.visible, shadowPassStats.culled, mainPassStats.visible, mainPassStats.culled, shadowCache.nUpdated, shadowCache.bUsed,
+             shadowPassStats.triangles, shadowTimer.lastMS, mainPassStats.triangles,
+             gl::stateStats.issued, gl::stateStats.filtered,
+             renderQueue.stats.programChanges, renderQueue.stats.textureChanges, renderQueue.stats.vaoChanges);
+        u32 nShadowed = std::count_if(std::begin(shadowAtlas.aSlots), std::end(shadowAtlas.aSlots), [](auto& s) { return s.light >= 0 && s.bValid; });
+        CERR("point lights: {}, cluster assignment cpu ms: {:.3f}, light indices: {} (dropped: {}), atlas shadows: {}, updated: {} ({} texels)\n",
+             nPointLights, _clusterTimeMS / _fpsCount, lightClusters.aIndices.size(), lightClusters.nDropped,
+             nShadowed, nAtlasUpdates, shadowAtlas.nUsedTexels);
+        CERR("shading: {}, shadow quality: {}, gpu ms: shadow {:.3f}, moment filter {:.3f}, main {:.3f}\n",
+             bDeferred ? "deferred" : "forward", SHADOW_QUALITY_NAMES[static_cast<int>(shadowQuality)], shadowTimer.lastMS,
+             shadowQuality != SHADOW_QUALITY::PCF ? filterTimer.lastMS : 0.0, mainTimer.lastMS);
+        if (bDynamicResolution)
+        {
+            CERR("dynamic resolution scale: {:.2f} ({}x{}), frame cost ms: {:.3f} (target {:.3f})\n",
+                 dynRes.scale, dynRes.renderWidth(), dynRes.renderHeight(), dynRes.avgMS, dynRes.targetMS);
+        }
+        if (bCountFragments && shadedFragments.bSupported)
+        {
+            f64 shaded = static_cast<f64>(shadedFragments.readAndReset()) / _fpsCount;
+            f64 pixels = bDynamicResolution ? dynRes.renderWidth() * dynRes.renderHeight() : app->wWidth * app->wHeight;
+            CERR("shaded fragments of the opaque main pass: {:.0f} ({:.2f} per pixel), depth pre-pass: {} (triangles: {})\n",
+                 shaded, shaded / pixels, bDepthPrepass, prepassStats.triangles);
+        }
         _fpsCount = 0;
+        _cpuTimeMS = 0;
+        _queueTimeMS = 0;
+        _clusterTimeMS = 0;
         _prevTime = _currTime;
     }
+    f64 _cpuStart = timeNowMS();
 #endif
     /* drawing */
         app->procEvents();
 
+        drawStats = {};
+        gl::stateStats = {};
         drawFrame(app);
+#ifdef FPS_COUNTER
+        _cpuTimeMS += timeNowMS() - _cpuStart;
+#endif
 
         app->swapBuffers();
     /* drawing */
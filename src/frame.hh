@@ -1,9 +1,35 @@
 #pragma once
 #include "controls.hh"
 
+/* how the six faces of the shadow cube are rendered */
+enum class SHADOW_PATH : int
+{
+    GEOMETRY, /* layered framebuffer, the geometry shader sends triangles to the face being drawn */
+    PER_FACE, /* one framebuffer per face, no geometry shader */
+    ESIZE
+};
+
+/* how the main light's shadow cube is filtered when shading */
+enum class SHADOW_QUALITY : int
+{
+    PCF, /* 20 depth compares per fragment */
+    MOMENTS, /* one filtered lookup into a half resolution cube of exponential depth moments */
+    MOMENTS_LOW, /* same at quarter resolution, softer and cheaper to filter */
+    ESIZE
+};
+
+constexpr const char* SHADOW_QUALITY_NAMES[] {"pcf", "moments", "moments low"};
+
 void run(App* app);
 
 extern PlayerControls player;
 extern f64 incCounter;
 extern f32 fov;
 extern f64 x, y, z;
+extern enum SHADOW_PATH shadowPath;
+extern enum SHADOW_QUALITY shadowQuality;
+extern bool bDepthPrepass; /* depth only pass first, then shade only the visible fragments with GL_EQUAL */
+extern u32 nPointLights; /* clustered lights on top of the shadowed one, up to MAX_POINT_LIGHTS */
+extern bool bDeferred; /* gbuffer pass, then lighting once per pixel instead of once per shaded fragment */
+extern bool bDynamicResolution; /* scene is rendered at the scale that holds the target frame time, then stretched */
+extern bool bCountFragments; /* fps counter reports fragments shaded by the opaque main pass, costs a readback per second */
@@ -0,0 +1,64 @@
+#include "gbuffer.hh"
+
+#include "utils.hh"
+
+GBuffer::~GBuffer()
+{
+    this->destroy();
+}
+
+void
+GBuffer::destroy()
+{
+    GLuint aTexs[] {this->albedoTex, this->normalTex, this->depthTex};
+    glDeleteTextures(std::size(aTexs), aTexs);
+    if (this->fbo)
+        glDeleteFramebuffers(1, &this->fbo);
+
+    this->fbo = this->albedoTex = this->normalTex = this->depthTex = 0;
+}
+
+static GLuint
+createTarget(GLenum format, int width, int height)
+{
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    return tex;
+}
+
+void
+GBuffer::resize(int _width, int _height)
+{
+    if (_width == this->width && _height == this->height && this->fbo)
+        return;
+
+    this->destroy();
+    this->width = _width, this->height = _height;
+
+    this->albedoTex = createTarget(GL_RGBA8, _width, _height);
+    this->normalTex = createTarget(GL_RGB10_A2, _width, _height);
+    this->depthTex = createTarget(GL_DEPTH_COMPONENT24, _width, _height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLenum aBuffers[] {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glGenFramebuffers(1, &this->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->albedoTex, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->normalTex, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->depthTex, 0);
+    glDrawBuffers(std::size(aBuffers), aBuffers);
+
+    if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER))
+        LOG(FATAL, "glCheckFramebufferStatus != GL_FRAMEBUFFER_COMPLETE\n");
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gl::invalidateState();
+    LOG(OK, "gbuffer: {}x{}\n", _width, _height);
+}
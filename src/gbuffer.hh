@@ -0,0 +1,27 @@
+#pragma once
+
+#include "gl/gl.hh"
+
+/* render targets of the deferred path: albedo, octahedral encoded world normal and depth, which is enough
+ * to rebuild the position. textures are sampled with texelFetch, so there is no filtering. call gl
+ * functions with the context bound */
+struct GBuffer
+{
+    GLuint fbo = 0;
+    GLuint albedoTex = 0; /* GL_RGBA8 */
+    GLuint normalTex = 0; /* GL_RGB10_A2, xy only */
+    GLuint depthTex = 0; /* GL_DEPTH_COMPONENT24 */
+    int width = 0;
+    int height = 0;
+
+    GBuffer() = default;
+    GBuffer(const GBuffer& other) = delete;
+    ~GBuffer();
+
+    GBuffer& operator=(const GBuffer& other) = delete;
+
+    void resize(int _width, int _height); /* recreates the targets only if the size changed */
+
+private:
+    void destroy();
+};
@@ -1,9 +1,356 @@
 #include "gl.hh"
 
+#include <cstring>
+
+#ifdef __linux__
+    #include <EGL/egl.h>
+    #include <GLES2/gl2ext.h>
+#endif
+
 namespace gl
 {
 
 GLenum lastErrorCode = 0;
 std::mutex mtxGlContext;
+StateStats stateStats {};
+
+constexpr unsigned MAX_TEXTURE_UNITS = 16;
+constexpr unsigned MAX_UNIFORM_POINTS = 8;
+
+enum CAP : unsigned
+{
+    CAP_CULL_FACE,
+    CAP_DEPTH_TEST,
+    CAP_BLEND,
+    CAP_SCISSOR_TEST,
+    CAP_ESIZE
+};
+
+struct UniformRange
+{
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+};
+
+/* what the context has bound, all ones means unknown and makes the next call go through */
+struct State
+{
+    GLuint program;
+    GLuint vao;
+    GLuint fbo;
+    GLenum activeUnit;
+    GLuint aTex2D[MAX_TEXTURE_UNITS];
+    GLuint aTexCube[MAX_TEXTURE_UNITS];
+    UniformRange aUniformRanges[MAX_UNIFORM_POINTS];
+    GLint aViewport[4];
+    GLenum cullFace;
+    GLuint aCaps[CAP_ESIZE]; /* 0, 1 or unknown */
+    GLenum blendSrc;
+    GLenum blendDst;
+    GLenum depthFunc;
+    GLuint depthMask; /* 0, 1 or unknown */
+    GLuint colorMask;
+};
+
+static State
+unknownState()
+{
+    State s;
+    memset(&s, 0xff, sizeof(s));
+    return s;
+}
+
+static State state = unknownState();
+
+static inline bool
+filter(bool bSame)
+{
+    if (bSame) stateStats.filtered++;
+    else stateStats.issued++;
+
+    return bSame;
+}
+
+void
+invalidateState()
+{
+    state = unknownState();
+}
+
+void
+useProgram(GLuint program)
+{
+    if (filter(state.program == program))
+        return;
+
+    glUseProgram(program);
+    state.program = program;
+}
+
+void
+bindVertexArray(GLuint vao)
+{
+    if (filter(state.vao == vao))
+        return;
+
+    glBindVertexArray(vao);
+    state.vao = vao;
+}
+
+void
+bindTexture(GLenum unit, GLenum target, GLuint tex)
+{
+    unsigned i = unit - GL_TEXTURE0;
+    GLuint* pBound = nullptr;
+    if (i < MAX_TEXTURE_UNITS)
+        pBound = target == GL_TEXTURE_CUBE_MAP ? &state.aTexCube[i] : target == GL_TEXTURE_2D ? &state.aTex2D[i] : nullptr;
+
+    if (pBound && filter(*pBound == tex))
+        return;
+
+    if (!filter(state.activeUnit == unit))
+    {
+        glActiveTexture(unit);
+        state.activeUnit = unit;
+    }
+
+    glBindTexture(target, tex);
+    if (pBound) *pBound = tex;
+    else stateStats.issued++;
+}
+
+void
+bindFramebuffer(GLuint fbo)
+{
+    if (filter(state.fbo == fbo))
+        return;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    state.fbo = fbo;
+}
+
+void
+bindUniformRange(GLuint point, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    UniformRange* pBound = point < MAX_UNIFORM_POINTS ? &state.aUniformRanges[point] : nullptr;
+    if (pBound && filter(pBound->buffer == buffer && pBound->offset == offset && pBound->size == size))
+        return;
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, point, buffer, offset, size);
+    if (pBound) *pBound = {buffer, offset, size};
+    else stateStats.issued++;
+}
+
+void
+viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLint* v = state.aViewport;
+    if (filter(v[0] == x && v[1] == y && v[2] == width && v[3] == height))
+        return;
+
+    glViewport(x, y, width, height);
+    v[0] = x, v[1] = y, v[2] = width, v[3] = height;
+}
+
+void
+cullFace(GLenum mode)
+{
+    if (filter(state.cullFace == mode))
+        return;
+
+    glCullFace(mode);
+    state.cullFace = mode;
+}
+
+static GLuint*
+capState(GLenum cap)
+{
+    switch (cap)
+    {
+        default: return nullptr;
+        case GL_CULL_FACE: return &state.aCaps[CAP_CULL_FACE];
+        case GL_DEPTH_TEST: return &state.aCaps[CAP_DEPTH_TEST];
+        case GL_BLEND: return &state.aCaps[CAP_BLEND];
+        case GL_SCISSOR_TEST: return &state.aCaps[CAP_SCISSOR_TEST];
+    }
+}
+
+static void
+setCap(GLenum cap, bool bEnable)
+{
+    GLuint* pCap = capState(cap);
+    if (pCap && filter(*pCap == static_cast<GLuint>(bEnable)))
+        return;
+
+    if (bEnable) glEnable(cap);
+    else glDisable(cap);
+
+    if (pCap) *pCap = bEnable;
+    else stateStats.issued++;
+}
+
+void
+enable(GLenum cap)
+{
+    setCap(cap, true);
+}
+
+void
+disable(GLenum cap)
+{
+    setCap(cap, false);
+}
+
+void
+blendFunc(GLenum src, GLenum dst)
+{
+    if (filter(state.blendSrc == src && state.blendDst == dst))
+        return;
+
+    glBlendFunc(src, dst);
+    state.blendSrc = src;
+    state.blendDst = dst;
+}
+
+void
+depthFunc(GLenum func)
+{
+    if (filter(state.depthFunc == func))
+        return;
+
+    glDepthFunc(func);
+    state.depthFunc = func;
+}
+
+void
+depthMask(GLboolean bWrite)
+{
+    if (filter(state.depthMask == static_cast<GLuint>(bWrite)))
+        return;
+
+    glDepthMask(bWrite);
+    state.depthMask = bWrite;
+}
+
+void
+colorMask(GLboolean bWrite)
+{
+    if (filter(state.colorMask == static_cast<GLuint>(bWrite)))
+        return;
+
+    glColorMask(bWrite, bWrite, bWrite, bWrite);
+    state.colorMask = bWrite;
+}
+
+#ifdef __linux__
+static PFNGLGETQUERYOBJECTUI64VEXTPROC pGetQueryObjectui64v = nullptr;
+#endif
+
+bool
+hasExtension(const char* name)
+{
+    GLint n = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+    for (GLint i = 0; i < n; i++)
+        if (strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), name) == 0)
+            return true;
+
+    return false;
+}
+
+void
+GpuTimer::create()
+{
+#ifdef __linux__
+    if (!hasExtension("GL_EXT_disjoint_timer_query"))
+        return;
+
+    pGetQueryObjectui64v = reinterpret_cast<PFNGLGETQUERYOBJECTUI64VEXTPROC>(eglGetProcAddress("glGetQueryObjectui64vEXT"));
+    if (!pGetQueryObjectui64v)
+        return;
+
+    glGenQueries(NFRAMES, this->aQueries);
+    this->bSupported = true;
+#endif
+}
+
+void
+GpuTimer::begin()
+{
+    if (!this->bSupported)
+        return;
+
+#ifdef __linux__
+    GLuint query = this->aQueries[this->frame % NFRAMES];
+
+    /* the query is reused, take its result from NFRAMES ago first */
+    if (this->frame >= NFRAMES)
+    {
+        GLuint bAvailable = 0;
+        GLint bDisjoint = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &bAvailable);
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &bDisjoint);
+
+        if (bAvailable && !bDisjoint)
+        {
+            GLuint64 ns = 0;
+            pGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            this->lastMS = ns / 1000000.0;
+        }
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED_EXT, query);
+#endif
+}
+
+void
+GpuTimer::end()
+{
+    if (!this->bSupported)
+        return;
+
+#ifdef __linux__
+    glEndQuery(GL_TIME_ELAPSED_EXT);
+#endif
+    this->frame++;
+}
+
+void
+AtomicCounter::create(GLuint point)
+{
+    GLint nCounters = 0;
+    glGetIntegerv(GL_MAX_FRAGMENT_ATOMIC_COUNTERS, &nCounters);
+    if (nCounters <= 0)
+        return;
+
+    GLuint zero = 0;
+    glGenBuffers(1, &this->buffer);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, this->buffer);
+    glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(zero), &zero, GL_DYNAMIC_READ);
+    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, point, this->buffer);
+    this->bSupported = true;
+}
+
+unsigned
+AtomicCounter::readAndReset()
+{
+    if (!this->bSupported)
+        return 0;
+
+    /* make the shader's atomic writes visible to the mapping */
+    glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
+
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, this->buffer);
+    auto* pCount = static_cast<GLuint*>(glMapBufferRange(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT | GL_MAP_WRITE_BIT));
+    if (!pCount)
+        return 0;
+
+    unsigned count = *pCount;
+    *pCount = 0;
+    glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
+
+    return count;
+}
 
 } /* namespace gl */
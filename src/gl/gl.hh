@@ -53,4 +53,60 @@ namespace gl
 extern GLenum lastErrorCode;
 extern std::mutex mtxGlContext;
 
+/* calls that went to the driver and calls dropped because the state was already set, reset each frame */
+struct StateStats
+{
+    unsigned long long issued;
+    unsigned long long filtered;
+};
+
+extern StateStats stateStats;
+
+/* state tracking wrappers for the render loop, they skip calls that would set what is already set.
+ * the cache only knows about changes made through these functions, so call invalidateState() after
+ * raw gl binds (loading, creating or deleting objects) before going back to the wrappers */
+void invalidateState();
+void useProgram(GLuint program);
+void bindVertexArray(GLuint vao);
+void bindTexture(GLenum unit, GLenum target, GLuint tex); /* unit is GL_TEXTURE0 + i, target is GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP */
+void bindFramebuffer(GLuint fbo);
+void bindUniformRange(GLuint point, GLuint buffer, GLintptr offset, GLsizeiptr size);
+void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void cullFace(GLenum mode);
+void enable(GLenum cap); /* GL_CULL_FACE, GL_DEPTH_TEST, GL_BLEND or GL_SCISSOR_TEST */
+void disable(GLenum cap);
+void blendFunc(GLenum src, GLenum dst);
+void depthFunc(GLenum func);
+void depthMask(GLboolean bWrite);
+void colorMask(GLboolean bWrite); /* all four channels */
+
+bool hasExtension(const char* name); /* goes through the whole list, don't call per frame */
+
+/* GL_EXT_disjoint_timer_query around a part of the frame. results are read NFRAMES later, so
+ * begin() never waits for the gpu. does nothing if the extension is missing */
+struct GpuTimer
+{
+    static constexpr unsigned NFRAMES = 3;
+
+    GLuint aQueries[NFRAMES] {};
+    unsigned frame = 0;
+    double lastMS = 0.0; /* latest available result */
+    bool bSupported = false;
+
+    void create();
+    void begin();
+    void end();
+};
+
+/* one GL_ATOMIC_COUNTER_BUFFER counter at a binding point. fragment shaders may have no atomic counters
+ * in gles (GL_MAX_FRAGMENT_ATOMIC_COUNTERS is 0), then nothing is created */
+struct AtomicCounter
+{
+    GLuint buffer = 0;
+    bool bSupported = false;
+
+    void create(GLuint point);
+    unsigned readAndReset(); /* waits for the gpu */
+};
+
 } /* namespace gl */
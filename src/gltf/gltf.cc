@@ -1,6 +1,8 @@
 #include "gltf.hh"
 #include "threadpool.hh"
 
+#include <algorithm>
+#include <cstring>
 #include <thread>
 
 namespace gltf
@@ -383,6 +385,7 @@ Asset::processAccessors()
         auto pByteOffset = json::searchObject(obj, "byteOffset");
         auto pComponentType = json::searchObject(obj, "componentType");
         if (!pComponentType) LOG(FATAL, "'componentType' field is required\n");
+        auto pNormalized = json::searchObject(obj, "normalized");
         auto pCount = json::searchObject(obj, "count");
         if (!pCount) LOG(FATAL, "'count' field is required\n");
         auto pMax = json::searchObject(obj, "max");
@@ -396,6 +399,7 @@ Asset::processAccessors()
             .bufferView = pBufferView ? static_cast<size_t>(json::getLong(pBufferView)) : 0,
             .byteOffset = pByteOffset ? static_cast<size_t>(json::getLong(pByteOffset)) : 0,
             .componentType = static_cast<enum COMPONENT_TYPE>(json::getLong(pComponentType)),
+            .normalized = pNormalized ? json::getBool(pNormalized) : false,
             .count = static_cast<size_t>(json::getLong(pCount)),
             .max = pMax ? accessorTypeToUnionType(type, pMax) : Type{},
             .min = pMin ? accessorTypeToUnionType(type, pMin) : Type{},
@@ -544,11 +548,22 @@ Asset::processMaterials()
             normTexInfo.index = json::getLong(pIndex);
         }
 
+        enum ALPHA_MODE alphaMode = ALPHA_MODE::SOLID;
+
+        auto pAlphaMode = json::searchObject(obj, "alphaMode");
+        if (pAlphaMode)
+        {
+            auto svMode = json::getStringView(pAlphaMode);
+            if (svMode == "MASK") alphaMode = ALPHA_MODE::MASK;
+            else if (svMode == "BLEND") alphaMode = ALPHA_MODE::BLEND;
+        }
+
         this->aMaterials.push_back({
             .pbrMetallicRoughness {
                 .baseColorTexture = texInfo,
             },
-            .normalTexture = normTexInfo
+            .normalTexture = normTexInfo,
+            .alphaMode = alphaMode
         });
     }
 }
@@ -623,6 +638,26 @@ Asset::processNodes()
             nNode.scale = ut.VEC3;
         }
 
+        auto pExtensions = json::searchObject(obj, "extensions");
+        if (pExtensions)
+        {
+            auto pInstancing = json::searchObject(json::getObject(pExtensions), "EXT_mesh_gpu_instancing");
+            if (pInstancing)
+            {
+                auto pAttributes = json::searchObject(json::getObject(pInstancing), "attributes");
+                if (!pAttributes) LOG(FATAL, "'attributes' field is required\n");
+                auto& oAttr = json::getObject(pAttributes);
+
+                auto pTRANSLATION = json::searchObject(oAttr, "TRANSLATION");
+                auto pROTATION = json::searchObject(oAttr, "ROTATION");
+                auto pSCALE = json::searchObject(oAttr, "SCALE");
+
+                if (pTRANSLATION) nNode.instancing.TRANSLATION = static_cast<size_t>(json::getLong(pTRANSLATION));
+                if (pROTATION) nNode.instancing.ROTATION = static_cast<size_t>(json::getLong(pROTATION));
+                if (pSCALE) nNode.instancing.SCALE = static_cast<size_t>(json::getLong(pSCALE));
+            }
+        }
+
         this->aNodes.push_back(std::move(nNode));
     }
 
@@ -645,8 +680,120 @@ Asset::processNodes()
         CERR("\ttranslation:\n{}\n", getUnionTypeString(ACCESSOR_TYPE::VEC3, *ut, "\t"));
         ut = reinterpret_cast<union Type*>(&node.scale);
         CERR("\tscale:\n{}\n", getUnionTypeString(ACCESSOR_TYPE::VEC3, *ut, "\t"));
+        if (node.isInstanced())
+            CERR("\tinstancing: TRANSLATION: '{}', ROTATION: '{}', SCALE: '{}'\n",
+                 node.instancing.TRANSLATION, node.instancing.ROTATION, node.instancing.SCALE);
     }
 #endif
 }
 
+/* Reads element `i` of the accessor into `pOut` as floats, normalized integers are mapped to [0, 1] or [-1, 1].
+ * Returns the number of components written. */
+int
+Asset::readAccessor(size_t accessorIdx, size_t i, f32* pOut) const
+{
+    auto& acc = this->aAccessors[accessorIdx];
+    auto& bv = this->aBufferViews[acc.bufferView];
+    auto& buff = this->aBuffers[bv.buffer];
+
+    int nComponents = accessorTypeComponents(acc.type);
+    size_t componentSize = 0;
+    switch (acc.componentType)
+    {
+        case COMPONENT_TYPE::BYTE:
+        case COMPONENT_TYPE::UNSIGNED_BYTE:
+            componentSize = 1;
+            break;
+        case COMPONENT_TYPE::SHORT:
+        case COMPONENT_TYPE::UNSIGNED_SHORT:
+            componentSize = 2;
+            break;
+        case COMPONENT_TYPE::UNSIGNED_INT:
+        case COMPONENT_TYPE::FLOAT:
+            componentSize = 4;
+            break;
+    }
+
+    size_t stride = bv.byteStride ? bv.byteStride : componentSize * nComponents;
+    const char* p = &buff.aBin[bv.byteOffset + acc.byteOffset + i*stride];
+
+    for (int c = 0; c < nComponents; c++, p += componentSize)
+    {
+        switch (acc.componentType)
+        {
+            case COMPONENT_TYPE::BYTE:
+                {
+                    s8 v = *reinterpret_cast<const s8*>(p);
+                    pOut[c] = acc.normalized ? std::max(v / 127.0f, -1.0f) : v;
+                }
+                break;
+            case COMPONENT_TYPE::UNSIGNED_BYTE:
+                {
+                    u8 v = *reinterpret_cast<const u8*>(p);
+                    pOut[c] = acc.normalized ? v / 255.0f : v;
+                }
+                break;
+            case COMPONENT_TYPE::SHORT:
+                {
+                    s16 v;
+                    memcpy(&v, p, sizeof(v));
+                    pOut[c] = acc.normalized ? std::max(v / 32767.0f, -1.0f) : v;
+                }
+                break;
+            case COMPONENT_TYPE::UNSIGNED_SHORT:
+                {
+                    u16 v;
+                    memcpy(&v, p, sizeof(v));
+                    pOut[c] = acc.normalized ? v / 65535.0f : v;
+                }
+                break;
+            case COMPONENT_TYPE::UNSIGNED_INT:
+                {
+                    u32 v;
+                    memcpy(&v, p, sizeof(v));
+                    pOut[c] = static_cast<f32>(v);
+                }
+                break;
+            case COMPONENT_TYPE::FLOAT:
+                memcpy(&pOut[c], p, sizeof(f32));
+                break;
+        }
+    }
+
+    return nComponents;
+}
+
+u32
+Asset::readIndex(size_t accessorIdx, size_t i) const
+{
+    auto& acc = this->aAccessors[accessorIdx];
+    auto& bv = this->aBufferViews[acc.bufferView];
+    const char* p = &this->aBuffers[bv.buffer].aBin[bv.byteOffset + acc.byteOffset];
+
+    switch (acc.componentType)
+    {
+        case COMPONENT_TYPE::UNSIGNED_BYTE:
+            return reinterpret_cast<const u8*>(p)[i];
+
+        case COMPONENT_TYPE::UNSIGNED_SHORT:
+            {
+                u16 v;
+                memcpy(&v, p + i*sizeof(v), sizeof(v));
+                return v;
+            }
+
+        case COMPONENT_TYPE::UNSIGNED_INT:
+            {
+                u32 v;
+                memcpy(&v, p + i*sizeof(v), sizeof(v));
+                return v;
+            }
+
+        default:
+            LOG(FATAL, "unsupported index component type: '{}'\n", static_cast<int>(acc.componentType));
+    }
+
+    return 0;
+}
+
 } /* namespace gltf */
@@ -72,6 +72,7 @@ struct Accessor
     size_t bufferView;
     size_t byteOffset; /* The offset relative to the start of the buffer view in bytes. This MUST be a multiple of the size of the component datatype. */
     enum COMPONENT_TYPE componentType; /* REQUIRED */
+    bool normalized = false; /* Specifies whether integer data values are normalized before usage. */
     size_t count; /* (REQUIRED) The number of elements referenced by this accessor, not to be confused with the number of bytes or number of components. */
     union Type max;
     union Type min;
@@ -91,6 +92,13 @@ struct Node
     v3 translation {};
     v4 rotation = qtIden();
     v3 scale {1, 1, 1};
+    struct {
+        size_t TRANSLATION = NPOS;
+        size_t ROTATION = NPOS;
+        size_t SCALE = NPOS;
+    } instancing; /* EXT_mesh_gpu_instancing attributes, each value is the index of the accessor with per instance data. */
+
+    bool isInstanced() const { return instancing.TRANSLATION != NPOS || instancing.ROTATION != NPOS || instancing.SCALE != NPOS; }
 };
 
 struct CameraPersp
@@ -189,10 +197,19 @@ struct PbrMetallicRoughness
     TextureInfo baseColorTexture;
 };
 
+/* "OPAQUE" in the spec, windows.h defines OPAQUE */
+enum class ALPHA_MODE
+{
+    SOLID,
+    MASK,
+    BLEND
+};
+
 struct Material
 {
     PbrMetallicRoughness pbrMetallicRoughness;
     NormalTextureInfo normalTexture;
+    enum ALPHA_MODE alphaMode = ALPHA_MODE::SOLID;
 };
 
 struct Asset
@@ -215,6 +232,8 @@ struct Asset
     Asset(std::string_view path);
 
     void load(std::string_view path);
+    int readAccessor(size_t accessorIdx, size_t i, f32* pOut) const;
+    u32 readIndex(size_t accessorIdx, size_t i) const;
 private:
     struct {
         json::Object* scene;
@@ -266,6 +285,16 @@ getComponentTypeString(enum COMPONENT_TYPE t)
     }
 }
 
+static inline int
+accessorTypeComponents(enum ACCESSOR_TYPE t)
+{
+    constexpr int nComponents[] {
+        1, 2, 3, 4, /*MAT2, Unused*/ 9, 16
+    };
+
+    return nComponents[static_cast<int>(t)];
+}
+
 static inline std::string_view
 getPrimitiveModeString(enum PRIMITIVES pm)
 {
@@ -4,6 +4,12 @@
 
 #include "gmath.hh"
 
+#include <algorithm>
+
+#ifdef __SSE2__
+    #include <immintrin.h>
+#endif
+
 static m4 m4LookAtInternal(const v3& R, const v3& U, const v3& D, const v3& P);
 
 v2::v2(const v3& v)
@@ -162,10 +168,48 @@ m4::operator*=(const m4& other)
     return *this;
 }
 
+#ifdef __SSE2__
+/* l * c, summed in the same order as the scalar version so the results match exactly */
+static inline __m128
+m4MulCol(const __m128 l[4], __m128 c)
+{
+    __m128 res = _mm_mul_ps(l[0], _mm_shuffle_ps(c, c, _MM_SHUFFLE(0, 0, 0, 0)));
+    res = _mm_add_ps(res, _mm_mul_ps(l[1], _mm_shuffle_ps(c, c, _MM_SHUFFLE(1, 1, 1, 1))));
+    res = _mm_add_ps(res, _mm_mul_ps(l[2], _mm_shuffle_ps(c, c, _MM_SHUFFLE(2, 2, 2, 2))));
+    res = _mm_add_ps(res, _mm_mul_ps(l[3], _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3))));
+
+    return res;
+}
+#endif
+
 m4
 operator*(const m4& l, const m4& r)
 {
     m4 res;
+
+#if defined __AVX__
+    /* two result columns per iteration */
+    __m256 lc[4];
+    for (int i = 0; i < 4; i++)
+        lc[i] = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(l.v[i].e));
+
+    for (int i = 0; i < 4; i += 2)
+    {
+        __m256 rc = _mm256_loadu_ps(r.v[i].e);
+        __m256 c = _mm256_mul_ps(lc[0], _mm256_shuffle_ps(rc, rc, _MM_SHUFFLE(0, 0, 0, 0)));
+        c = _mm256_add_ps(c, _mm256_mul_ps(lc[1], _mm256_shuffle_ps(rc, rc, _MM_SHUFFLE(1, 1, 1, 1))));
+        c = _mm256_add_ps(c, _mm256_mul_ps(lc[2], _mm256_shuffle_ps(rc, rc, _MM_SHUFFLE(2, 2, 2, 2))));
+        c = _mm256_add_ps(c, _mm256_mul_ps(lc[3], _mm256_shuffle_ps(rc, rc, _MM_SHUFFLE(3, 3, 3, 3))));
+        _mm256_storeu_ps(res.v[i].e, c);
+    }
+#elif defined __SSE2__
+    __m128 lc[4];
+    for (int i = 0; i < 4; i++)
+        lc[i] = _mm_loadu_ps(l.v[i].e);
+
+    for (int i = 0; i < 4; i++)
+        _mm_storeu_ps(res.v[i].e, m4MulCol(lc, _mm_loadu_ps(r.v[i].e)));
+#else
     for (int i = 0; i < 4; i++)
     {
         res.e[i][0] = (l.e[0][0]*r.e[i][0]) + (l.e[1][0]*r.e[i][1]) + (l.e[2][0]*r.e[i][2]) + (l.e[3][0]*r.e[i][3]); 
@@ -173,8 +217,31 @@ operator*(const m4& l, const m4& r)
         res.e[i][2] = (l.e[0][2]*r.e[i][0]) + (l.e[1][2]*r.e[i][1]) + (l.e[2][2]*r.e[i][2]) + (l.e[3][2]*r.e[i][3]); 
         res.e[i][3] = (l.e[0][3]*r.e[i][0]) + (l.e[1][3]*r.e[i][1]) + (l.e[2][3]*r.e[i][2]) + (l.e[3][3]*r.e[i][3]); 
     }
+#endif
+
+    return res;
+}
+
+v4
+operator*(const m4& l, const v4& r)
+{
+#ifdef __SSE2__
+    __m128 lc[4];
+    for (int i = 0; i < 4; i++)
+        lc[i] = _mm_loadu_ps(l.v[i].e);
+
+    v4 res;
+    _mm_storeu_ps(res.e, m4MulCol(lc, _mm_loadu_ps(r.e)));
 
     return res;
+#else
+    return {
+        (l.e[0][0]*r.x) + (l.e[1][0]*r.y) + (l.e[2][0]*r.z) + (l.e[3][0]*r.w),
+        (l.e[0][1]*r.x) + (l.e[1][1]*r.y) + (l.e[2][1]*r.z) + (l.e[3][1]*r.w),
+        (l.e[0][2]*r.x) + (l.e[1][2]*r.y) + (l.e[2][2]*r.z) + (l.e[3][2]*r.w),
+        (l.e[0][3]*r.x) + (l.e[1][3]*r.y) + (l.e[2][3]*r.z) + (l.e[3][3]*r.w)
+    };
+#endif
 }
 
 m4
@@ -236,43 +303,51 @@ m4RotZ(const m4& m, const f32 angle)
     return m * axisZ;
 }
 
+/* scaling and translation only touch some of the columns, no need for full multiplication */
 m4
 m4Scale(const m4& m, const f32 s)
 {
-    m4 sm {.e {
-        {s, 0, 0, 0},
-        {0, s, 0, 0},
-        {0, 0, s, 0},
-        {0, 0, 0, 1}
-    }};
-
-    return m * sm;
+    return m4Scale(m, v3 {s, s, s});
 }
 
 m4
 m4Scale(const m4& m, const v3& s)
 {
-    m4 sm {.e {
-        {s.x, 0,   0,   0},
-        {0,   s.y, 0,   0},
-        {0,   0,   s.z, 0},
-        {0,   0,   0,   1}
-    }};
+    m4 res = m;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 4; j++)
+            res.e[i][j] *= s.e[i];
 
-    return m * sm;
+    return res;
 }
 
 m4
 m4Translate(const m4& m, const v3& tv)
 {
-    m4 tm {.e {
-        {1,    0,    0,    0},
-        {0,    1,    0,    0},
-        {0,    0,    1,    0},
-        {tv.x, tv.y, tv.z, 1}
-    }};
+    m4 res = m;
+
+#ifdef __SSE2__
+    __m128 mc[4];
+    for (int i = 0; i < 4; i++)
+        mc[i] = _mm_loadu_ps(m.v[i].e);
+
+    _mm_storeu_ps(res.v[3].e, m4MulCol(mc, _mm_setr_ps(tv.x, tv.y, tv.z, 1.0f)));
+#else
+    res.v[3] = m * v4 {tv.x, tv.y, tv.z, 1};
+#endif
+
+    return res;
+}
 
-    return m * tm;
+/* same as m4Scale(m4Translate(m4Iden(), t) * qtRot(r), s) */
+m4
+m4TRS(const v3& t, const qt& r, const v3& s)
+{
+    m4 res = qtRot(r);
+    res = m4Scale(res, s);
+    res.v[3] = {t.x, t.y, t.z, 1};
+
+    return res;
 }
 
 m4
@@ -403,10 +478,87 @@ m3Inverse(const m3& m)
     };
 }
 
-m3 
+/* cofactors from the 2x2 determinants of the top and bottom row pairs */
+m4
+m4Inverse(const m4& m)
+{
+    auto e = m.e;
+    f32 s0 = e[0][0] * e[1][1] - e[1][0] * e[0][1];
+    f32 s1 = e[0][0] * e[1][2] - e[1][0] * e[0][2];
+    f32 s2 = e[0][0] * e[1][3] - e[1][0] * e[0][3];
+    f32 s3 = e[0][1] * e[1][2] - e[1][1] * e[0][2];
+    f32 s4 = e[0][1] * e[1][3] - e[1][1] * e[0][3];
+    f32 s5 = e[0][2] * e[1][3] - e[1][2] * e[0][3];
+
+    f32 c5 = e[2][2] * e[3][3] - e[3][2] * e[2][3];
+    f32 c4 = e[2][1] * e[3][3] - e[3][1] * e[2][3];
+    f32 c3 = e[2][1] * e[3][2] - e[3][1] * e[2][2];
+    f32 c2 = e[2][0] * e[3][3] - e[3][0] * e[2][3];
+    f32 c1 = e[2][0] * e[3][2] - e[3][0] * e[2][2];
+    f32 c0 = e[2][0] * e[3][1] - e[3][0] * e[2][1];
+
+    f32 invdet = 1.0f / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+
+    m4 r;
+    r.e[0][0] = ( e[1][1] * c5 - e[1][2] * c4 + e[1][3] * c3) * invdet;
+    r.e[0][1] = (-e[0][1] * c5 + e[0][2] * c4 - e[0][3] * c3) * invdet;
+    r.e[0][2] = ( e[3][1] * s5 - e[3][2] * s4 + e[3][3] * s3) * invdet;
+    r.e[0][3] = (-e[2][1] * s5 + e[2][2] * s4 - e[2][3] * s3) * invdet;
+
+    r.e[1][0] = (-e[1][0] * c5 + e[1][2] * c2 - e[1][3] * c1) * invdet;
+    r.e[1][1] = ( e[0][0] * c5 - e[0][2] * c2 + e[0][3] * c1) * invdet;
+    r.e[1][2] = (-e[3][0] * s5 + e[3][2] * s2 - e[3][3] * s1) * invdet;
+    r.e[1][3] = ( e[2][0] * s5 - e[2][2] * s2 + e[2][3] * s1) * invdet;
+
+    r.e[2][0] = ( e[1][0] * c4 - e[1][1] * c2 + e[1][3] * c0) * invdet;
+    r.e[2][1] = (-e[0][0] * c4 + e[0][1] * c2 - e[0][3] * c0) * invdet;
+    r.e[2][2] = ( e[3][0] * s4 - e[3][1] * s2 + e[3][3] * s0) * invdet;
+    r.e[2][3] = (-e[2][0] * s4 + e[2][1] * s2 - e[2][3] * s0) * invdet;
+
+    r.e[3][0] = (-e[1][0] * c3 + e[1][1] * c1 - e[1][2] * c0) * invdet;
+    r.e[3][1] = ( e[0][0] * c3 - e[0][1] * c1 + e[0][2] * c0) * invdet;
+    r.e[3][2] = (-e[3][0] * s3 + e[3][1] * s1 - e[3][2] * s0) * invdet;
+    r.e[3][3] = ( e[2][0] * s3 - e[2][1] * s1 + e[2][2] * s0) * invdet;
+
+    return r;
+}
+
+/* inverse transpose, its columns are the cross products of the other two columns divided by the determinant */
+m3
 m3Normal(const m3& m)
 {
+#ifdef __SSE2__
+    /* m3 has room for 12 floats, so 4 wide loads and stores of the last column stay inside */
+    const __m128 mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    __m128 a = _mm_and_ps(_mm_loadu_ps(m.v[0].e), mask);
+    __m128 b = _mm_and_ps(_mm_loadu_ps(m.v[1].e), mask);
+    __m128 c = _mm_and_ps(_mm_loadu_ps(m.v[2].e), mask);
+
+    auto cross = [](__m128 l, __m128 r) -> __m128 {
+        __m128 lyzx = _mm_shuffle_ps(l, l, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 lzxy = _mm_shuffle_ps(l, l, _MM_SHUFFLE(3, 1, 0, 2));
+        __m128 ryzx = _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 rzxy = _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 1, 0, 2));
+        return _mm_sub_ps(_mm_mul_ps(lyzx, rzxy), _mm_mul_ps(lzxy, ryzx));
+    };
+
+    __m128 bc = cross(b, c);
+    __m128 ca = cross(c, a);
+    __m128 ab = cross(a, b);
+
+    alignas(16) f32 d[4];
+    _mm_store_ps(d, _mm_mul_ps(a, bc));
+    __m128 invdet = _mm_set1_ps(1.0f / (d[0] + d[1] + d[2]));
+
+    m3 res;
+    _mm_storeu_ps(res.v[0].e, _mm_mul_ps(bc, invdet));
+    _mm_storeu_ps(res.v[1].e, _mm_mul_ps(ca, invdet));
+    _mm_storeu_ps(res.v[2].e, _mm_mul_ps(ab, invdet));
+
+    return res;
+#else
     return m3Transpose(m3Inverse(m));
+#endif
 }
 
 v3
@@ -445,9 +597,9 @@ qtRot(const qt& q)
     auto& s = q.s;
 
     return {.e {
-        {1 - 2*y*y - 2*z*z, 2*x*y - 2*s*z,     2*x*z + 2*s*y,     0},
-        {2*x*y + 2*s*z,     1 - 2*x*x - 2*z*z, 2*y*z - 2*s*x,     0},
-        {2*x*z - 2*s*y,     2*y*z + 2*s*x,     1 - 2*x*x - 2*y*y, 0},
+        {1 - 2*y*y - 2*z*z, 2*x*y + 2*s*z,     2*x*z - 2*s*y,     0},
+        {2*x*y - 2*s*z,     1 - 2*x*x - 2*z*z, 2*y*z + 2*s*x,     0},
+        {2*x*z + 2*s*y,     2*y*z - 2*s*x,     1 - 2*x*x - 2*y*y, 0},
         {0,                 0,                 0,                 1}
     }};
 }
@@ -461,12 +613,29 @@ qtConj(const qt& q)
 qt
 operator*(const qt& l, const qt& r)
 {
+#ifdef __SSE2__
+    /* each column of the product is one component of l times shuffled and negated r */
+    __m128 rv = _mm_loadu_ps(r.p);
+    __m128 res = _mm_mul_ps(_mm_set1_ps(l.s), rv);
+    res = _mm_add_ps(res, _mm_mul_ps(_mm_set1_ps(l.x),
+                                     _mm_xor_ps(_mm_shuffle_ps(rv, rv, _MM_SHUFFLE(0, 1, 2, 3)), _mm_setr_ps(0.0f, -0.0f, 0.0f, -0.0f))));
+    res = _mm_add_ps(res, _mm_mul_ps(_mm_set1_ps(l.y),
+                                     _mm_xor_ps(_mm_shuffle_ps(rv, rv, _MM_SHUFFLE(1, 0, 3, 2)), _mm_setr_ps(0.0f, 0.0f, -0.0f, -0.0f))));
+    res = _mm_add_ps(res, _mm_mul_ps(_mm_set1_ps(l.z),
+                                     _mm_xor_ps(_mm_shuffle_ps(rv, rv, _MM_SHUFFLE(2, 3, 0, 1)), _mm_setr_ps(-0.0f, 0.0f, 0.0f, -0.0f))));
+
+    qt q;
+    _mm_storeu_ps(q.p, res);
+
+    return q;
+#else
     return {
         l.s*r.x + l.x*r.s + l.y*r.z - l.z*r.y,
         l.s*r.y - l.x*r.z + l.y*r.s + l.z*r.x,
         l.s*r.z + l.x*r.y - l.y*r.x + l.z*r.s,
         l.s*r.s - l.x*r.x - l.y*r.y - l.z*r.z,
     };
+#endif
 }
 
 qt
@@ -474,3 +643,134 @@ operator*=(qt& l, const qt& r)
 {
     return l = l * r;
 }
+
+AABB
+aabbUnion(const AABB& l, const AABB& r)
+{
+    return {
+        .min {std::min(l.min.x, r.min.x), std::min(l.min.y, r.min.y), std::min(l.min.z, r.min.z)},
+        .max {std::max(l.max.x, r.max.x), std::max(l.max.y, r.max.y), std::max(l.max.z, r.max.z)}
+    };
+}
+
+/* transform center and extents, extents go through the absolute matrix (Arvo) */
+AABB
+aabbTransform(const AABB& box, const m4& tm)
+{
+    v3 c = (box.min + box.max) * 0.5f;
+    v3 e = (box.max - box.min) * 0.5f;
+    auto& m = tm.e;
+
+    v3 nc {
+        m[0][0]*c.x + m[1][0]*c.y + m[2][0]*c.z + m[3][0],
+        m[0][1]*c.x + m[1][1]*c.y + m[2][1]*c.z + m[3][1],
+        m[0][2]*c.x + m[1][2]*c.y + m[2][2]*c.z + m[3][2]
+    };
+    v3 ne {
+        std::abs(m[0][0])*e.x + std::abs(m[1][0])*e.y + std::abs(m[2][0])*e.z,
+        std::abs(m[0][1])*e.x + std::abs(m[1][1])*e.y + std::abs(m[2][1])*e.z,
+        std::abs(m[0][2])*e.x + std::abs(m[1][2])*e.y + std::abs(m[2][2])*e.z
+    };
+
+    return {.min = nc - ne, .max = nc + ne};
+}
+
+static void
+frustumSetPlane(Frustum* f, int i, f32 nx, f32 ny, f32 nz, f32 d)
+{
+    f->nx[i] = nx;
+    f->ny[i] = ny;
+    f->nz[i] = nz;
+    f->d[i] = d;
+}
+
+Frustum
+frustumFromTm(const m4& tm)
+{
+    Frustum f {};
+    auto& e = tm.e;
+
+    /* Gribb-Hartmann: sum and difference of the last row with the others */
+    for (int i = 0; i < 3; i++)
+    {
+        frustumSetPlane(&f, i*2,
+                        e[0][3] + e[0][i], e[1][3] + e[1][i], e[2][3] + e[2][i], e[3][3] + e[3][i]);
+        frustumSetPlane(&f, i*2 + 1,
+                        e[0][3] - e[0][i], e[1][3] - e[1][i], e[2][3] - e[2][i], e[3][3] - e[3][i]);
+    }
+    frustumSetPlane(&f, 6, 0, 0, 0, 1);
+    frustumSetPlane(&f, 7, 0, 0, 0, 1);
+
+    return f;
+}
+
+Frustum
+frustumFromAABB(const AABB& box)
+{
+    Frustum f {};
+
+    frustumSetPlane(&f, 0,  1,  0,  0, -box.min.x);
+    frustumSetPlane(&f, 1, -1,  0,  0,  box.max.x);
+    frustumSetPlane(&f, 2,  0,  1,  0, -box.min.y);
+    frustumSetPlane(&f, 3,  0, -1,  0,  box.max.y);
+    frustumSetPlane(&f, 4,  0,  0,  1, -box.min.z);
+    frustumSetPlane(&f, 5,  0,  0, -1,  box.max.z);
+    frustumSetPlane(&f, 6,  0,  0,  0,  1);
+    frustumSetPlane(&f, 7,  0,  0,  0,  1);
+
+    return f;
+}
+
+bool
+frustumTestAABB(const Frustum& f, const AABB& box)
+{
+    v3 c = (box.min + box.max) * 0.5f;
+    v3 e = (box.max - box.min) * 0.5f;
+
+#ifdef __SSE2__
+    /* box is outside if center is further behind any plane than its projected radius */
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+    const __m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+
+    for (int i = 0; i < 8; i += 4)
+    {
+        __m128 nx = _mm_load_ps(&f.nx[i]);
+        __m128 ny = _mm_load_ps(&f.ny[i]);
+        __m128 nz = _mm_load_ps(&f.nz[i]);
+
+        __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, nx), _mm_mul_ps(cy, ny)),
+                                 _mm_add_ps(_mm_mul_ps(cz, nz), _mm_load_ps(&f.d[i])));
+        __m128 rad = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_and_ps(nx, absMask)), _mm_mul_ps(ey, _mm_and_ps(ny, absMask))),
+                                _mm_mul_ps(ez, _mm_and_ps(nz, absMask)));
+
+        if (_mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, rad), _mm_setzero_ps())))
+            return false;
+    }
+
+    return true;
+#else
+    for (int i = 0; i < 6; i++)
+    {
+        f32 dist = c.x*f.nx[i] + c.y*f.ny[i] + c.z*f.nz[i] + f.d[i];
+        f32 rad = e.x*std::abs(f.nx[i]) + e.y*std::abs(f.ny[i]) + e.z*std::abs(f.nz[i]);
+
+        if (dist + rad < 0.0f)
+            return false;
+    }
+
+    return true;
+#endif
+}
+
+bool
+sphereTestAABB(const v3& center, f32 radius, const AABB& box)
+{
+    /* closest point of the box */
+    v3 p {std::clamp(center.x, box.min.x, box.max.x),
+          std::clamp(center.y, box.min.y, box.max.y),
+          std::clamp(center.z, box.min.z, box.max.z)};
+    v3 d = p - center;
+
+    return v3Dot(d, d) <= radius * radius;
+}
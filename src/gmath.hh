@@ -121,6 +121,21 @@ union qt
     constexpr qt(v3 _v, f32 _s) : x(_v.x), y(_v.y), z(_v.z), s(_s) {}
 };
 
+struct AABB
+{
+    v3 min;
+    v3 max;
+};
+
+/* plane components are stored separately for 4 wide tests, planes 6 and 7 are padding that never rejects */
+struct Frustum
+{
+    alignas(16) f32 nx[8];
+    alignas(16) f32 ny[8];
+    alignas(16) f32 nz[8];
+    alignas(16) f32 d[8];
+};
+
 #ifdef LOGS
 std::string m4ToString(const m4& m, std::string_view prefix);
 std::string m3ToString(const m3& m, std::string_view prefix = "");
@@ -169,6 +184,7 @@ f32 v3Dist(const v3& l, const v3& r); /* distance between two points in space */
 f32 v3Dot(const v3& l, const v3& r);
 f32 v4Dot(const v4& l, const v4& r);
 m4 operator*(const m4& l, const m4& r);
+v4 operator*(const m4& l, const v4& r);
 m4 m4Rot(const m4& m, const f32 th, const v3& ax);
 m4 m4RotX(const m4& m, const f32 angle);
 m4 m4RotY(const m4& m, const f32 angle);
@@ -176,12 +192,14 @@ m4 m4RotZ(const m4& m, const f32 angle);
 m4 m4Scale(const m4& m, const f32 s);
 m4 m4Scale(const m4& m, const v3& s);
 m4 m4Translate(const m4& m, const v3& tv);
+m4 m4TRS(const v3& t, const qt& r, const v3& s); /* translation * rotation * scale */
 m4 m4Pers(const f32 fov, const f32 asp, const f32 n, const f32 f);
 m4 m4Ortho(const f32 l, const f32 r, const f32 b, const f32 t, const f32 n, const f32 f);
 m4 m4LookAt(const v3& eyeV, const v3& centerV, const v3& upV);
 m4 m4Transpose(const m4& m);
 m3 m3Transpose(const m3& m);
 m3 m3Inverse(const m3& m);
+m4 m4Inverse(const m4& m); /* general, for projections too */
 m3 m3Normal(const m3& m);
 v3 v3Color(const u32 hex);
 v4 v4Color(const u32 hex);
@@ -190,3 +208,9 @@ m4 qtRot(const qt& q);
 qt qtConj(const qt& q);
 qt operator*(const qt& l, const qt& r);
 qt operator*=(qt& l, const qt& r);
+AABB aabbUnion(const AABB& l, const AABB& r);
+AABB aabbTransform(const AABB& box, const m4& tm);
+Frustum frustumFromTm(const m4& tm); /* clip volume of tm (usually proj * view) in its source space */
+Frustum frustumFromAABB(const AABB& box);
+bool frustumTestAABB(const Frustum& f, const AABB& box); /* false if box is completely outside */
+bool sphereTestAABB(const v3& center, f32 radius, const AABB& box); /* same for a sphere */
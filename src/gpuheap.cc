@@ -0,0 +1,500 @@
+#include "gpuheap.hh"
+#include "model.hh"
+
+#include <algorithm>
+#include <cstring>
+
+/* pools start this big and at least double when they grow */
+constexpr u32 MIN_VERTS = 1 << 14;
+constexpr u32 MIN_INDEX_WORDS = 1 << 15;
+
+GLsizei
+vertexFormatStride(enum VERTEX_FORMAT fmt)
+{
+    switch (fmt)
+    {
+        default:
+        case VERTEX_FORMAT::FULL: return sizeof(Vertex);
+        case VERTEX_FORMAT::QUANTIZED:
+        case VERTEX_FORMAT::QUANTIZED_HALF_TEX: return sizeof(QuantizedVertex);
+        case VERTEX_FORMAT::POS_TEX: return 5 * sizeof(f32);
+        case VERTEX_FORMAT::POS_TEX_NORM: return 8 * sizeof(f32);
+    }
+}
+
+GLsizei
+vertexFormatPositionSize(enum VERTEX_FORMAT fmt)
+{
+    switch (fmt)
+    {
+        case VERTEX_FORMAT::QUANTIZED:
+        case VERTEX_FORMAT::QUANTIZED_HALF_TEX: return sizeof(QuantizedVertex::pos);
+        default: return 3 * sizeof(f32);
+    }
+}
+
+void
+setPositionAttributes(enum VERTEX_FORMAT fmt, GLuint vbo)
+{
+    GLsizei stride = vertexFormatPositionSize(fmt);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray(0);
+
+    if (fmt == VERTEX_FORMAT::QUANTIZED || fmt == VERTEX_FORMAT::QUANTIZED_HALF_TEX)
+        glVertexAttribPointer(0, 4, GL_SHORT, GL_TRUE, stride, nullptr);
+    else glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, nullptr);
+}
+
+void
+setVertexFormatAttributes(enum VERTEX_FORMAT fmt, GLuint vbo)
+{
+    GLsizei stride = vertexFormatStride(fmt);
+
+    auto attrib = [&](GLuint loc, GLint size, GLenum type, GLboolean bNorm, size_t offset) {
+        glEnableVertexAttribArray(loc);
+        glVertexAttribPointer(loc, size, type, bNorm, stride, reinterpret_cast<void*>(offset));
+    };
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    switch (fmt)
+    {
+        default:
+        case VERTEX_FORMAT::FULL:
+            attrib(0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, pos));
+            attrib(1, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, tex));
+            attrib(2, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, norm));
+            attrib(3, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, tan));
+            attrib(4, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, bitan));
+            break;
+
+        case VERTEX_FORMAT::QUANTIZED:
+        case VERTEX_FORMAT::QUANTIZED_HALF_TEX:
+            /* positions, w is the bitangent sign */
+            attrib(0, 4, GL_SHORT, GL_TRUE, offsetof(QuantizedVertex, pos));
+            if (fmt == VERTEX_FORMAT::QUANTIZED_HALF_TEX)
+                attrib(1, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(QuantizedVertex, tex));
+            else
+                attrib(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(QuantizedVertex, tex));
+            /* octahedral normals and tangents */
+            attrib(2, 2, GL_SHORT, GL_TRUE, offsetof(QuantizedVertex, norm));
+            attrib(3, 2, GL_SHORT, GL_TRUE, offsetof(QuantizedVertex, tan));
+            break;
+
+        case VERTEX_FORMAT::POS_TEX_NORM:
+            attrib(2, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(f32));
+            [[fallthrough]];
+        case VERTEX_FORMAT::POS_TEX:
+            attrib(0, 3, GL_FLOAT, GL_FALSE, 0);
+            attrib(1, 2, GL_FLOAT, GL_FALSE, 3 * sizeof(f32));
+            break;
+    }
+}
+
+/* byte ranges to keep when a buffer is reallocated */
+struct Move
+{
+    size_t src;
+    size_t dst;
+    size_t size;
+};
+
+/* reallocates the storage of buffer id, data goes through a scratch buffer so the name stays the same */
+static void
+repackBuffer(GLuint id, const std::vector<Move>& aMoves, size_t newSize)
+{
+    size_t scratchSize = 0;
+    for (auto& m : aMoves)
+        scratchSize = std::max(scratchSize, m.dst + m.size);
+
+    GLuint scratch = 0;
+    if (scratchSize > 0)
+    {
+        glGenBuffers(1, &scratch);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+        glBufferData(GL_COPY_WRITE_BUFFER, scratchSize, nullptr, GL_STREAM_COPY);
+        glBindBuffer(GL_COPY_READ_BUFFER, id);
+        for (auto& m : aMoves)
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, m.src, m.dst, m.size);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+    glBufferData(GL_COPY_WRITE_BUFFER, newSize, nullptr, GL_STATIC_DRAW);
+
+    if (scratch)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, scratch);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, std::min(scratchSize, newSize));
+        glDeleteBuffers(1, &scratch);
+    }
+}
+
+void
+GpuHeap::Arena::give(u32 offset, u32 size)
+{
+    if (size == 0)
+        return;
+
+    auto it = std::lower_bound(this->aFree.begin(), this->aFree.end(), offset, [](const Block& b, u32 off) { return b.offset < off; });
+    it = this->aFree.insert(it, {offset, size});
+
+    /* merge with the next block, then with the previous one */
+    auto next = it + 1;
+    if (next != this->aFree.end() && it->offset + it->size == next->offset)
+    {
+        it->size += next->size;
+        this->aFree.erase(next);
+    }
+    if (it != this->aFree.begin())
+    {
+        auto prev = it - 1;
+        if (prev->offset + prev->size == it->offset)
+        {
+            prev->size += it->size;
+            this->aFree.erase(it);
+        }
+    }
+}
+
+/* first fit */
+bool
+GpuHeap::Arena::take(u32 size, u32* pOffset)
+{
+    for (auto it = this->aFree.begin(); it != this->aFree.end(); ++it)
+    {
+        if (it->size < size)
+            continue;
+
+        *pOffset = it->offset;
+        it->offset += size;
+        it->size -= size;
+        if (it->size == 0)
+            this->aFree.erase(it);
+
+        return true;
+    }
+
+    return false;
+}
+
+/* at least doubles, so that loading many small meshes doesn't copy the buffer each time */
+void
+GpuHeap::Arena::grow(u32 minFree, u32 minCapacity)
+{
+    u32 newCapacity = std::max({this->capacity * 2, this->capacity + minFree, minCapacity});
+    repackBuffer(this->id, {{0, 0, size_t(this->capacity) * this->unitSize}}, size_t(newCapacity) * this->unitSize);
+    if (this->mirrorId)
+        repackBuffer(this->mirrorId, {{0, 0, size_t(this->capacity) * this->mirrorUnitSize}}, size_t(newCapacity) * this->mirrorUnitSize);
+
+    this->give(this->capacity, newCapacity - this->capacity);
+    this->capacity = newCapacity;
+}
+
+GpuHeap::~GpuHeap()
+{
+    for (auto& p : this->aPools)
+    {
+        if (!p.vao)
+            continue;
+
+        GLuint aBuffers[] {p.verts.id, p.verts.mirrorId, p.inds.id};
+        glDeleteBuffers(LEN(aBuffers), aBuffers);
+
+        /* zeros of arrays that were never made are ignored */
+        GLuint aVaos[] {p.vao, p.depthVao, p.instVao, p.depthInstVao};
+        glDeleteVertexArrays(LEN(aVaos), aVaos);
+    }
+}
+
+void
+GpuHeap::createPool(enum VERTEX_FORMAT fmt)
+{
+    auto& p = this->pool(fmt);
+
+    GLuint aBuffers[3];
+    glGenBuffers(LEN(aBuffers), aBuffers);
+    p.verts.id = aBuffers[0];
+    p.verts.unitSize = vertexFormatStride(fmt);
+    p.verts.mirrorId = aBuffers[1];
+    p.verts.mirrorUnitSize = vertexFormatPositionSize(fmt);
+    p.inds.id = aBuffers[2];
+    p.inds.unitSize = 4;
+
+    glGenVertexArrays(1, &p.vao);
+    glBindVertexArray(p.vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p.inds.id);
+    setVertexFormatAttributes(fmt, p.verts.id);
+
+    glGenVertexArrays(1, &p.depthVao);
+    glBindVertexArray(p.depthVao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p.inds.id);
+    setPositionAttributes(fmt, p.verts.mirrorId);
+    glBindVertexArray(0);
+
+    p.verts.grow(0, MIN_VERTS);
+    p.inds.grow(0, MIN_INDEX_WORDS);
+}
+
+GpuRange
+GpuHeap::alloc(enum VERTEX_FORMAT fmt, const void* pVerts, u32 nVerts, const void* pIndices, u32 nIndexBytes)
+{
+    std::lock_guard lock(this->mtx);
+
+    auto& p = this->pool(fmt);
+    if (!p.vao)
+        this->createPool(fmt);
+
+    u32 nWords = (nIndexBytes + 3) / 4;
+    Alloc a {fmt, true, {0, nVerts}, {0, nWords}};
+
+    if (nVerts && !p.verts.take(nVerts, &a.verts.offset))
+    {
+        p.verts.grow(nVerts, 0);
+        p.verts.take(nVerts, &a.verts.offset);
+    }
+    if (nWords && !p.inds.take(nWords, &a.inds.offset))
+    {
+        p.inds.grow(nWords, 0);
+        p.inds.take(nWords, &a.inds.offset);
+    }
+
+    p.verts.used += nVerts;
+    p.inds.used += nWords;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, p.verts.id);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, size_t(a.verts.offset) * p.verts.unitSize, size_t(nVerts) * p.verts.unitSize, pVerts);
+
+    /* positions are the first bytes of each vertex */
+    u32 posSize = p.verts.mirrorUnitSize;
+    std::vector<u8> aPositions(size_t(nVerts) * posSize);
+    for (u32 i = 0; i < nVerts; i++)
+        memcpy(&aPositions[size_t(i) * posSize], static_cast<const u8*>(pVerts) + size_t(i) * p.verts.unitSize, posSize);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, p.verts.mirrorId);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, size_t(a.verts.offset) * posSize, aPositions.size(), aPositions.data());
+    if (nIndexBytes)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, p.inds.id);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, size_t(a.inds.offset) * p.inds.unitSize, nIndexBytes, pIndices);
+    }
+
+    GpuRange r;
+    if (!this->aFreeIds.empty())
+    {
+        r.id = this->aFreeIds.back();
+        this->aFreeIds.pop_back();
+        this->aAllocs[r.id] = a;
+    }
+    else
+    {
+        r.id = this->aAllocs.size();
+        this->aAllocs.push_back(a);
+    }
+
+    return r;
+}
+
+void
+GpuHeap::free(GpuRange range)
+{
+    if (!range.valid())
+        return;
+
+    std::lock_guard lock(this->mtx);
+
+    auto& a = this->aAllocs[range.id];
+    auto& p = this->pool(a.fmt);
+
+    p.verts.give(a.verts.offset, a.verts.size);
+    p.inds.give(a.inds.offset, a.inds.size);
+    p.verts.used -= a.verts.size;
+    p.inds.used -= a.inds.size;
+
+    a.bLive = false;
+    this->aFreeIds.push_back(range.id);
+}
+
+void
+GpuHeap::defragment()
+{
+    std::lock_guard lock(this->mtx);
+
+    for (int f = 0; f < static_cast<int>(VERTEX_FORMAT::ESIZE); f++)
+    {
+        auto& p = this->aPools[f];
+        if (!p.vao)
+            continue;
+
+        /* live allocs of this pool in buffer order, packed one after another */
+        auto repack = [&](Arena* pArena, Block Alloc::* pBlock) {
+            std::vector<Alloc*> aLive;
+            for (auto& a : this->aAllocs)
+                if (a.bLive && static_cast<int>(a.fmt) == f && (a.*pBlock).size > 0)
+                    aLive.push_back(&a);
+
+            std::sort(aLive.begin(), aLive.end(), [&](Alloc* l, Alloc* r) { return (l->*pBlock).offset < (r->*pBlock).offset; });
+
+            /* in units, contiguous ranges are copied in one go */
+            std::vector<Move> aMoves;
+            u32 end = 0;
+            for (Alloc* a : aLive)
+            {
+                Block& b = a->*pBlock;
+
+                if (!aMoves.empty() && aMoves.back().src + aMoves.back().size == b.offset)
+                    aMoves.back().size += b.size;
+                else aMoves.push_back({b.offset, end, b.size});
+
+                b.offset = end;
+                end += b.size;
+            }
+
+            auto repackInBytes = [&](GLuint id, size_t unit, u32 capacity) {
+                std::vector<Move> aByteMoves(aMoves.size());
+                for (size_t i = 0; i < aMoves.size(); i++)
+                    aByteMoves[i] = {aMoves[i].src * unit, aMoves[i].dst * unit, aMoves[i].size * unit};
+                repackBuffer(id, aByteMoves, size_t(capacity) * unit);
+            };
+
+            /* keep one unit so the buffer is never empty */
+            u32 newCapacity = std::max(end, 1u);
+            repackInBytes(pArena->id, pArena->unitSize, newCapacity);
+            if (pArena->mirrorId)
+                repackInBytes(pArena->mirrorId, pArena->mirrorUnitSize, newCapacity);
+            pArena->capacity = newCapacity;
+            pArena->aFree.clear();
+            pArena->give(end, newCapacity - end);
+        };
+
+        repack(&p.verts, &Alloc::verts);
+        repack(&p.inds, &Alloc::inds);
+    }
+}
+
+enum VERTEX_FORMAT
+GpuHeap::format(GpuRange range) const
+{
+    return this->aAllocs[range.id].fmt;
+}
+
+GLuint
+GpuHeap::vao(enum VERTEX_FORMAT fmt) const
+{
+    return this->pool(fmt).vao;
+}
+
+GLuint
+GpuHeap::instVao(enum VERTEX_FORMAT fmt)
+{
+    std::lock_guard lock(this->mtx);
+
+    auto& p = this->pool(fmt);
+    if (p.instVao || !p.vao)
+        return p.instVao;
+
+    glGenVertexArrays(1, &p.instVao);
+    glBindVertexArray(p.instVao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p.inds.id);
+    setVertexFormatAttributes(fmt, p.verts.id);
+    for (GLuint c = 0; c < 4; c++)
+    {
+        glEnableVertexAttribArray(INSTANCE_ATTRIB_LOC + c);
+        glVertexAttribDivisor(INSTANCE_ATTRIB_LOC + c, 1);
+    }
+    glBindVertexArray(0);
+
+    return p.instVao;
+}
+
+GLuint
+GpuHeap::depthVao(enum VERTEX_FORMAT fmt) const
+{
+    return this->pool(fmt).depthVao;
+}
+
+GLuint
+GpuHeap::depthInstVao(enum VERTEX_FORMAT fmt)
+{
+    std::lock_guard lock(this->mtx);
+
+    auto& p = this->pool(fmt);
+    if (p.depthInstVao || !p.vao)
+        return p.depthInstVao;
+
+    glGenVertexArrays(1, &p.depthInstVao);
+    glBindVertexArray(p.depthInstVao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p.inds.id);
+    setPositionAttributes(fmt, p.verts.mirrorId);
+    for (GLuint c = 0; c < 4; c++)
+    {
+        glEnableVertexAttribArray(INSTANCE_ATTRIB_LOC + c);
+        glVertexAttribDivisor(INSTANCE_ATTRIB_LOC + c, 1);
+    }
+    glBindVertexArray(0);
+
+    return p.depthInstVao;
+}
+
+GLuint
+GpuHeap::vbo(enum VERTEX_FORMAT fmt) const
+{
+    return this->pool(fmt).verts.id;
+}
+
+GLuint
+GpuHeap::positionVbo(enum VERTEX_FORMAT fmt) const
+{
+    return this->pool(fmt).verts.mirrorId;
+}
+
+GLuint
+GpuHeap::ebo(enum VERTEX_FORMAT fmt) const
+{
+    return this->pool(fmt).inds.id;
+}
+
+GLint
+GpuHeap::baseVertex(GpuRange range) const
+{
+    return range.valid() ? this->aAllocs[range.id].verts.offset : 0;
+}
+
+size_t
+GpuHeap::indexOffset(GpuRange range) const
+{
+    return range.valid() ? size_t(this->aAllocs[range.id].inds.offset) * 4 : 0;
+}
+
+GpuHeapStats
+GpuHeap::stats() const
+{
+    std::lock_guard lock(this->mtx);
+
+    GpuHeapStats s {};
+    for (auto& p : this->aPools)
+    {
+        if (!p.vao)
+            continue;
+
+        s.buffers += 3;
+        s.vaos += 2 + (p.instVao ? 1 : 0) + (p.depthInstVao ? 1 : 0);
+        for (const Arena* a : {&p.verts, &p.inds})
+        {
+            s.capacity += size_t(a->capacity) * (a->unitSize + a->mirrorUnitSize);
+            s.used += size_t(a->used) * (a->unitSize + a->mirrorUnitSize);
+            s.freeBlocks += a->aFree.size();
+        }
+    }
+    s.ranges = this->aAllocs.size() - this->aFreeIds.size();
+
+    return s;
+}
+
+void
+GpuHeap::logStats([[maybe_unused]] std::string_view when) const
+{
+    [[maybe_unused]] auto s = this->stats();
+    LOG(OK, "gpu heap {}: {} buffers, {} vertex arrays, {} ranges, {} of {} bytes used ({} bytes overhead in {} free blocks)\n",
+        when, s.buffers, s.vaos, s.ranges, s.used, s.capacity, s.capacity - s.used, s.freeBlocks);
+}
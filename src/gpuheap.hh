@@ -0,0 +1,128 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include "gl/gl.hh"
+#include "utils.hh"
+
+/* vertex attribute locations of per instance mat4 columns */
+constexpr GLuint INSTANCE_ATTRIB_LOC = 5;
+
+/* vertex layouts that get their own pool */
+enum class VERTEX_FORMAT : u8
+{
+    FULL,               /* Vertex */
+    QUANTIZED,          /* QuantizedVertex */
+    QUANTIZED_HALF_TEX, /* QuantizedVertex with half float texture coords */
+    POS_TEX,            /* 3 + 2 floats */
+    POS_TEX_NORM,       /* 3 + 2 + 3 floats */
+    ESIZE
+};
+
+GLsizei vertexFormatStride(enum VERTEX_FORMAT fmt);
+GLsizei vertexFormatPositionSize(enum VERTEX_FORMAT fmt); /* positions come first in every format */
+void setVertexFormatAttributes(enum VERTEX_FORMAT fmt, GLuint vbo); /* into the bound vertex array, offsets start at 0 */
+void setPositionAttributes(enum VERTEX_FORMAT fmt, GLuint vbo); /* same for a tightly packed position stream */
+
+/* vertex and index range in the heap, stays valid across GpuHeap::defragment() */
+struct GpuRange
+{
+    u32 id = ~0u;
+
+    bool valid() const { return this->id != ~0u; }
+};
+
+struct GpuHeapStats
+{
+    u32 buffers; /* gl objects */
+    u32 vaos;
+    u32 ranges; /* live allocations */
+    u32 freeBlocks;
+    u64 capacity; /* bytes of vram held by the pools */
+    u64 used;
+};
+
+/* every format pool is one vertex buffer, one index buffer and one vertex array shared by all meshes,
+ * draws pick their range with base vertex and index offset. buffer names never change, so vertex arrays
+ * made outside of the heap stay valid when pools grow or get defragmented.
+ * pools also keep a copy of just the positions with the same vertex offsets, so depth only passes
+ * draw the same ranges through depthVao() without fetching the other attributes.
+ * call with the gl context bound */
+struct GpuHeap
+{
+    GpuHeap() = default;
+    GpuHeap(const GpuHeap& other) = delete;
+    ~GpuHeap();
+
+    GpuHeap& operator=(const GpuHeap& other) = delete;
+
+    GpuRange alloc(enum VERTEX_FORMAT fmt, const void* pVerts, u32 nVerts, const void* pIndices, u32 nIndexBytes);
+    void free(GpuRange range);
+    void defragment(); /* packs live ranges to the front of each pool and shrinks buffers to fit */
+
+    enum VERTEX_FORMAT format(GpuRange range) const;
+    GLuint vao(enum VERTEX_FORMAT fmt) const;
+    GLuint instVao(enum VERTEX_FORMAT fmt); /* same attributes plus per instance matrix, pointers are set by the render queue */
+    GLuint depthVao(enum VERTEX_FORMAT fmt) const; /* position stream only */
+    GLuint depthInstVao(enum VERTEX_FORMAT fmt); /* position stream plus per instance matrix */
+    GLuint vbo(enum VERTEX_FORMAT fmt) const;
+    GLuint positionVbo(enum VERTEX_FORMAT fmt) const;
+    GLuint ebo(enum VERTEX_FORMAT fmt) const;
+    GLint baseVertex(GpuRange range) const;
+    size_t indexOffset(GpuRange range) const; /* in bytes */
+    GpuHeapStats stats() const;
+    void logStats(std::string_view when) const;
+
+private:
+    struct Block
+    {
+        u32 offset;
+        u32 size;
+    };
+
+    /* one buffer, offsets and sizes are in units (vertices or 4 byte index words) */
+    struct Arena
+    {
+        GLuint id = 0;
+        u32 unitSize = 1;
+        u32 capacity = 0;
+        u32 used = 0;
+        std::vector<Block> aFree; /* sorted by offset, neighbours are merged */
+        GLuint mirrorId = 0; /* optional buffer laid out in the same units, repacked along with id */
+        u32 mirrorUnitSize = 0;
+
+        bool take(u32 size, u32* pOffset);
+        void give(u32 offset, u32 size);
+        void grow(u32 minFree, u32 minCapacity);
+    };
+
+    struct Pool
+    {
+        Arena verts;
+        Arena inds;
+        GLuint vao = 0;
+        GLuint instVao = 0;
+        GLuint depthVao = 0;
+        GLuint depthInstVao = 0;
+    };
+
+    struct Alloc
+    {
+        enum VERTEX_FORMAT fmt;
+        bool bLive;
+        Block verts;
+        Block inds;
+    };
+
+    Pool aPools[static_cast<int>(VERTEX_FORMAT::ESIZE)];
+    std::vector<Alloc> aAllocs;
+    std::vector<u32> aFreeIds; /* of dead allocs for reuse */
+    mutable std::mutex mtx;
+
+    Pool& pool(enum VERTEX_FORMAT fmt) { return this->aPools[static_cast<int>(fmt)]; }
+    const Pool& pool(enum VERTEX_FORMAT fmt) const { return this->aPools[static_cast<int>(fmt)]; }
+    void createPool(enum VERTEX_FORMAT fmt);
+};
+
+extern GpuHeap gpuHeap; /* defined before the models in frame.cc, so it outlives them */
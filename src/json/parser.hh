@@ -81,4 +81,10 @@ getStringView(Object* obj)
     return std::get<std::string_view>(obj->tagVal.val);
 }
 
+static inline bool
+getBool(Object* obj)
+{
+    return std::get<bool>(obj->tagVal.val);
+}
+
 } /* namespace json */
@@ -1,12 +1,45 @@
+#include <cfloat>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <semaphore>
 #include <thread>
 #include <unordered_map>
 
 #include "model.hh"
+#include "renderqueue.hh"
 #include "parser/obj.hh"
 
 static void parseMtl(std::unordered_map<u64, Materials>* materials, std::string_view path, GLint texMode, App* c);
 static void setTanBitan(Vertex* ver1, Vertex* ver2, Vertex* ver3);
-static void setBuffers(std::vector<Vertex>* vs, std::vector<GLuint>* els, MeshData* mesh, GLint drawMode, App* c);
+static void setBuffers(std::vector<Vertex>* vs, std::vector<GLuint>* els, MeshData* mesh, App* c);
+static void setGLTFBuffers(const gltf::Asset& a, const gltf::Primitive& primitive, const std::vector<GLuint>& aBufferMap, Mesh* pMesh, GLint drawMode);
+static void setGLTFAttributes(const gltf::Asset& a, const gltf::Primitive& primitive, GLuint vbo);
+static void setMeshAttributes(const gltf::Asset& a, const gltf::Primitive& primitive, const Mesh& m);
+static std::vector<m4> getInstanceTms(const gltf::Asset& a, const gltf::Node& node);
+static void setInstanceBuffers(const gltf::Asset& a, const gltf::Mesh& mesh, const std::vector<Mesh>& aMeshes, const std::vector<m4>& aTms, Instances* pInst, GLint drawMode);
+static void setInstanceAttributes(GLuint vbo);
+
+DrawStats drawStats {};
+
+/* vertex and index data ready for upload */
+struct QuantizedPrimitive
+{
+    std::vector<QuantizedVertex> aVerts;
+    std::vector<u8> aIndices;
+    enum gltf::COMPONENT_TYPE indType;
+    size_t nIndices;
+    bool bHalfTex;
+};
+
+static void setQuantizedBuffers(const QuantizedPrimitive& qp, Mesh* pMesh);
+static void getQuantizationBounds(const v3& min, const v3& max, v3* pCenter, f32* pScale);
+static void getQuantizationBounds(const std::vector<v3>& aPos, v3* pCenter, f32* pScale);
+static void getQuantizationBounds(const gltf::Asset& a, const gltf::Mesh& mesh, v3* pCenter, f32* pScale);
+static m4 getDequantTm(const v3& center, f32 scale);
+static QuantizedPrimitive quantizeVertices(const std::vector<Vertex>& aVerts, const std::vector<GLuint>& aInds, const v3& center, f32 scale);
+static QuantizedPrimitive quantizeGLTFPrimitive(const gltf::Asset& a, const gltf::Primitive& primitive, const v3& center, f32 scale);
+static void readGLTFPrimitive(const gltf::Asset& a, const gltf::Primitive& primitive, std::vector<Vertex>* pVerts, std::vector<GLuint>* pInds);
 
 enum HASH : u64
 {
@@ -26,18 +59,93 @@ enum HASH : u64
     norm = hashFNV("norm")
 };
 
+/* how many decoded images may wait for the upload at once */
+constexpr std::ptrdiff_t MAX_IMAGES_IN_FLIGHT = 8;
+
+/* Single gl submission stage of the loading pipeline.
+ * Loader pushes jobs directly, workers `promise()` a job before they start reading/decoding and `deliver()` it later.
+ * `drain()` runs everything under one context bind per batch until nothing is queued or promised. */
+struct UploadQueue
+{
+    std::mutex mtx;
+    std::condition_variable cnd;
+    std::deque<std::function<void()>> qJobs;
+    size_t nPromised = 0;
+    std::counting_semaphore<MAX_IMAGES_IN_FLIGHT> semSlots {MAX_IMAGES_IN_FLIGHT};
+
+    void
+    push(std::function<void()> job)
+    {
+        std::lock_guard lock(this->mtx);
+        this->qJobs.emplace_back(std::move(job));
+        this->cnd.notify_one();
+    }
+
+    void
+    promise()
+    {
+        std::lock_guard lock(this->mtx);
+        this->nPromised++;
+    }
+
+    void
+    deliver(std::function<void()> job)
+    {
+        std::lock_guard lock(this->mtx);
+        this->qJobs.emplace_back(std::move(job));
+        this->nPromised--;
+        this->cnd.notify_one();
+    }
+
+    void acquireSlot() { this->semSlots.acquire(); }
+    void releaseSlot() { this->semSlots.release(); }
+
+    void
+    drain(App* c)
+    {
+        std::deque<std::function<void()>> qBatch;
+
+        while (true)
+        {
+            {
+                std::unique_lock lock(this->mtx);
+                this->cnd.wait(lock, [this]{ return !this->qJobs.empty() || this->nPromised == 0; });
+
+                if (this->qJobs.empty())
+                    return;
+
+                std::swap(qBatch, this->qJobs);
+            }
+
+            std::lock_guard lock(gl::mtxGlContext);
+            c->bindGlContext();
+
+            for (auto& job : qBatch)
+                job();
+            qBatch.clear();
+
+            c->unbindGlContext();
+        }
+    }
+};
+
 Model::Model(Model&& other)
 {
-    this->aaMeshes = std::move(other.aaMeshes);
-    this->savedPath = std::move(other.savedPath);
+    *this = std::move(other);
 }
 
-Model::Model(std::string_view path, GLint drawMode, GLint texMode, App* c)
+Model::Model(std::string_view path, GLint drawMode, GLint texMode, App* c, enum LOAD flags)
 {
-    this->loadOBJ(path, drawMode, texMode, c);
+    this->loadOBJ(path, drawMode, texMode, c, flags);
 }
 
 Model::~Model()
+{
+    this->destroy();
+}
+
+void
+Model::destroy()
 {
     if (!this->aaMeshes.empty())
     {
@@ -46,24 +154,89 @@ Model::~Model()
             for (auto& m : mm)
             {
                 auto& o = m.meshData;
+                if (o.range.valid())
+                {
+                    gpuHeap.free(o.range);
+                    continue;
+                }
+
                 glDeleteVertexArrays(1, &o.vao);
                 glDeleteBuffers(1, &o.vbo);
                 glDeleteBuffers(1, &o.ebo);
+                if (o.instVao)
+                    glDeleteVertexArrays(1, &o.instVao);
             }
         }
     }
+
+    for (auto& b : this->aStaticBatches)
+        gpuHeap.free(b.meshData.range);
+
+    for (auto& inst : this->aInstances)
+    {
+        if (inst.count)
+        {
+            glDeleteVertexArrays(inst.aVaos.size(), inst.aVaos.data());
+            glDeleteVertexArrays(inst.aDepthVaos.size(), inst.aDepthVaos.data());
+            glDeleteBuffers(1, &inst.vbo);
+        }
+    }
 }
 
 Model&
 Model::operator=(Model&& other)
 {
+    if (this == &other)
+        return *this;
+
+    this->destroy();
+
+    this->savedPath = other.savedPath;
     this->aaMeshes = std::move(other.aaMeshes);
-    this->savedPath = std::move(other.savedPath);
+    this->aInstances = std::move(other.aInstances);
+    this->aMeshBounds = std::move(other.aMeshBounds);
+    this->aTmDequant = std::move(other.aTmDequant);
+    this->bQuantized = other.bQuantized;
+    this->asset = std::move(other.asset);
+
+    this->aRetained = std::move(other.aRetained);
+    this->aRetainedTms = std::move(other.aRetainedTms);
+    this->aDrawDataCache = std::move(other.aDrawDataCache);
+    this->drawStride = other.drawStride;
+    this->bDrawListValid = other.bDrawListValid;
+    this->bDrawListGraph = other.bDrawListGraph;
+    this->pDrawRing = other.pDrawRing;
+    this->drawBase = other.drawBase;
+
+    this->aaBatchTms = std::move(other.aaBatchTms);
+    this->aBatchDepths = std::move(other.aBatchDepths);
+    this->aStaticBatches = std::move(other.aStaticBatches);
+    this->aStaticDequant = std::move(other.aStaticDequant);
+    this->aStaticNodes = std::move(other.aStaticNodes);
+
+    this->aGraphOrder = std::move(other.aGraphOrder);
+    this->aGraphPos = std::move(other.aGraphPos);
+    this->aGraphSubtreeEnds = std::move(other.aGraphSubtreeEnds);
+    this->aMeshNodes = std::move(other.aMeshNodes);
+    this->aDirtyNodes = std::move(other.aDirtyNodes);
+    this->transforms = std::move(other.transforms);
+    this->aNormalTms = std::move(other.aNormalTms);
+    this->tmLastGlobal = other.tmLastGlobal;
+    this->bGraphValid = other.bGraphValid;
+
+    /* gl objects and heap ranges belong to this now, other's destructor must find nothing to free */
+    other.aaMeshes.clear();
+    other.aInstances.clear();
+    other.aStaticBatches.clear();
+    other.aRetained.clear();
+    other.bDrawListValid = false;
+    other.bGraphValid = false;
+
     return *this;
 }
 
 void
-Model::parseOBJ(std::string_view path, GLint drawMode, GLint texMode, App* c)
+Model::parseOBJ(std::string_view path, GLint texMode, App* c, enum LOAD flags)
 {
     parser::WaveFrontObj objP(path, " /\n\t\r");
 
@@ -216,6 +389,20 @@ Model::parseOBJ(std::string_view path, GLint drawMode, GLint texMode, App* c)
     verts.reserve(vs.size());
     inds.reserve(vs.size());
 
+    /* every object goes into one mesh, so they share the bounds */
+    this->bQuantized = flags & LOAD::QUANTIZE;
+    v3 center {};
+    f32 scale = 1.0f;
+    if (this->bQuantized)
+    {
+        getQuantizationBounds(vs, &center, &scale);
+        this->aTmDequant.push_back(getDequantTm(center, scale));
+    }
+    else
+    {
+        this->aTmDequant.push_back(m4Iden());
+    }
+
     this->aaMeshes.push_back({});
     for (auto& materials : objects)
     {
@@ -252,18 +439,50 @@ Model::parseOBJ(std::string_view path, GLint drawMode, GLint texMode, App* c)
                 /* make tangent and bitangent vectors */
                 setTanBitan(&verts[verts.size() - 1], &verts[verts.size() - 2], &verts[verts.size() - 3]);
             }
-            setBuffers(&verts, &inds, &mesh, drawMode, c);
-            mesh.eboSize = (GLuint)inds.size();
+            Mesh nMesh {
+                .meshData {},
+                .indType = gltf::COMPONENT_TYPE::UNSIGNED_INT,
+                .mode = gltf::PRIMITIVES::TRIANGLES,
+                .triangleCount = NPOS,
+            };
+
+            /* from face positions, vertices shared with previous objects don't end up in verts */
+            if (!faces.fs.empty())
+            {
+                v3 p0 = vs[faces.fs.front()[0]];
+                nMesh.bounds = {p0, p0};
+                for (auto& face : faces.fs)
+                    for (size_t i = 0; i < LEN(face.pos); i += 3)
+                        nMesh.bounds = aabbUnion(nMesh.bounds, {vs[face[i]], vs[face[i]]});
+            }
+
+            if (this->bQuantized)
+            {
+                auto qp = quantizeVertices(verts, inds, center, scale);
+
+                std::lock_guard lock(gl::mtxGlContext);
+                c->bindGlContext();
+                setQuantizedBuffers(qp, &nMesh);
+                c->unbindGlContext();
+
+                mesh.vao = nMesh.meshData.vao;
+                mesh.depthVao = nMesh.meshData.depthVao;
+                mesh.vbo = nMesh.meshData.vbo;
+                mesh.ebo = nMesh.meshData.ebo;
+                mesh.eboSize = nMesh.meshData.eboSize;
+                mesh.range = nMesh.meshData.range;
+            }
+            else
+            {
+                setBuffers(&verts, &inds, &mesh, c);
+                mesh.eboSize = (GLuint)inds.size();
+            }
 
             auto foundTex = materialsMap.find(hashFNV(faces.usemtl));
             mesh.materials = std::move(foundTex->second);
 
-            this->aaMeshes.back().push_back({
-                .meshData = std::move(mesh),
-                .indType = gltf::COMPONENT_TYPE::UNSIGNED_INT,
-                .mode = gltf::PRIMITIVES::TRIANGLES,
-                .triangleCount = NPOS,
-            });
+            nMesh.meshData = std::move(mesh);
+            this->aaMeshes.back().push_back(std::move(nMesh));
 
             /* TODO: these will be needed later */
             verts.clear();
@@ -275,52 +494,40 @@ Model::parseOBJ(std::string_view path, GLint drawMode, GLint texMode, App* c)
 }
 
 void
-Model::load(std::string_view path, GLint drawMode, GLint texMode, App* c)
+Model::load(std::string_view path, GLint drawMode, GLint texMode, App* c, enum LOAD flags)
 {
+    [[maybe_unused]] f64 loadStart = timeNowS();
+
     if (path.ends_with(".obj"))
-        this->loadOBJ(path, drawMode, texMode, c);
+        this->loadOBJ(path, drawMode, texMode, c, flags);
     else if (path.ends_with(".gltf"))
-        this->loadGLTF(path, drawMode, texMode, c);
+        this->loadGLTF(path, drawMode, texMode, c, flags);
     else
         LOG(FATAL, "trying to load unsupported asset: '{}'\n", path);
 
     this->savedPath = path;
+    LOG(OK, "'{}' loaded in {:.3f} s\n", path, timeNowS() - loadStart);
 }
 
 void
-Model::loadOBJ(std::string_view path, GLint drawMode, GLint texMode, App* c)
+Model::loadOBJ(std::string_view path, [[maybe_unused]] GLint drawMode, GLint texMode, App* c, enum LOAD flags)
 {
     LOG(OK, "loading model: '{}'...\n", path);
-    this->parseOBJ(path, drawMode, texMode, c);
+    this->parseOBJ(path, texMode, c, flags);
     this->savedPath = path;
 }
 
 void
-Model::loadGLTF(std::string_view path, GLint drawMode, GLint texMode, App* c)
+Model::loadGLTF(std::string_view path, GLint drawMode, GLint texMode, App* c, enum LOAD flags)
 {
     this->asset.load(path);
-    auto& a = this->asset;;
+    auto& a = this->asset;
 
+    /* declared before the pool, so workers can't outlive it */
+    UploadQueue q;
     ThreadPool tp(std::thread::hardware_concurrency());
 
-    /* load buffers first */
-    std::vector<GLuint> aBufferMap;
-    for (size_t i = 0; i < a.aBuffers.size(); i++)
-    {
-        std::scoped_lock lock(gl::mtxGlContext);
-        c->bindGlContext();
-
-        GLuint b;
-        glGenBuffers(1, &b);
-        glBindBuffer(GL_ARRAY_BUFFER, b);
-        glBufferData(GL_ARRAY_BUFFER, a.aBuffers[i].byteLength, a.aBuffers[i].aBin.data(), drawMode);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        aBufferMap.push_back(b);
-
-        c->unbindGlContext();
-    }
-
-    /* preload texures */
+    /* start reading and decoding textures right away, they are uploaded as soon as they are ready */
     std::vector<Texture> aTex(a.aImages.size());
     for (size_t i = 0; i < a.aImages.size(); i++)
     {
@@ -328,111 +535,206 @@ Model::loadGLTF(std::string_view path, GLint drawMode, GLint texMode, App* c)
         auto uri = a.aImages[i].uri;
 
         if (uri.ends_with(".bmp"))
-            tp.submit([=]{
-                *p = Texture(replacePathSuffix(path, uri), TEX_TYPE::DIFFUSE, true, texMode, c);
+        {
+            q.promise();
+            tp.submit([=, &q]{
+                q.acquireSlot();
+                auto img = std::make_shared<ImageData>(decodeBMP(replacePathSuffix(path, uri), true));
+                q.deliver([=, &q]() mutable {
+                    p->upload(*img, texMode);
+                    img.reset();
+                    q.releaseSlot();
+                });
             });
+        }
     }
-    tp.wait();
 
-    size_t meshIdx = NPOS;
-    for (auto& mesh : a.aMeshes)
-    {
-        std::vector<Mesh> aNMeshes;
+    /* allocate all meshes up front, queued jobs keep pointers to them */
+    this->aaMeshes.resize(a.aMeshes.size());
+    for (size_t i = 0; i < a.aMeshes.size(); i++)
+        this->aaMeshes[i].resize(a.aMeshes[i].aPrimitives.size());
 
-        for (auto& primitive : mesh.aPrimitives)
+    /* POSITION min/max are required by the spec */
+    this->aMeshBounds.resize(a.aMeshes.size());
+    for (size_t i = 0; i < a.aMeshes.size(); i++)
+    {
+        for (size_t j = 0; j < a.aMeshes[i].aPrimitives.size(); j++)
         {
-            size_t accIndIdx = primitive.indices;
-            size_t accPosIdx = primitive.attributes.POSITION;
-            size_t accNormIdx = primitive.attributes.NORMAL;
-            size_t accTexIdx = primitive.attributes.TEXCOORD_0;
-            size_t accTanIdx = primitive.attributes.TANGENT;
-            size_t accMatIdx = primitive.material;
-            enum gltf::PRIMITIVES mode = primitive.mode;
+            auto& acc = a.aAccessors[a.aMeshes[i].aPrimitives[j].attributes.POSITION];
+            AABB bounds {.min = acc.min.VEC3, .max = acc.max.VEC3};
 
-            auto& accPos = a.aAccessors[accPosIdx];
-            auto& accTex = a.aAccessors[accTexIdx];
+            this->aaMeshes[i][j].bounds = bounds;
+            this->aMeshBounds[i] = j == 0 ? bounds : aabbUnion(this->aMeshBounds[i], bounds);
+        }
+    }
 
-            auto& bvPos = a.aBufferViews[accPos.bufferView];
-            auto& bvTex = a.aBufferViews[accTex.bufferView];
+    this->bQuantized = flags & LOAD::QUANTIZE;
+    this->aTmDequant.resize(a.aMeshes.size(), m4Iden());
 
-            Mesh nMesh {};
+    /* raw buffer bytes vs what ends up in vram */
+    [[maybe_unused]] size_t nOrigBytes = 0, nQuantBytes = 0;
 
-            nMesh.mode = mode;
+    std::vector<GLuint> aBufferMap(a.aBuffers.size());
+    if (this->bQuantized)
+    {
+        for (size_t i = 0; i < a.aMeshes.size(); i++)
+        {
+            /* POSITION min/max are required, so bounds are known before reading anything */
+            v3 center {};
+            f32 scale = 1.0f;
+            getQuantizationBounds(a, a.aMeshes[i], &center, &scale);
+            this->aTmDequant[i] = getDequantTm(center, scale);
 
-            /* manually unlock before loading texture */
-            gl::mtxGlContext.lock();
-            c->bindGlContext();
+            for (size_t j = 0; j < a.aMeshes[i].aPrimitives.size(); j++)
+            {
+                auto* pPrim = &a.aMeshes[i].aPrimitives[j];
+                auto* pMesh = &this->aaMeshes[i][j];
+
+                q.promise();
+                tp.submit([&, pPrim, pMesh, center, scale]{
+                    auto qp = std::make_shared<QuantizedPrimitive>(quantizeGLTFPrimitive(a, *pPrim, center, scale));
+                    q.deliver([&, pPrim, pMesh, qp]{
+                        pMesh->mode = pPrim->mode;
+                        setQuantizedBuffers(*qp, pMesh);
+                        nQuantBytes += qp->aVerts.size()*sizeof(QuantizedVertex) + qp->aIndices.size();
+                    });
+                });
+            }
+        }
 
-            glGenVertexArrays(1, &nMesh.meshData.vao);
-            glBindVertexArray(nMesh.meshData.vao);
+        for (auto& b : a.aBuffers)
+            nOrigBytes += b.byteLength;
+    }
+    else
+    {
+        /* buffers are already in memory, queue them first */
+        for (size_t i = 0; i < a.aBuffers.size(); i++)
+        {
+            q.push([&, i]{
+                GLuint b;
+                glGenBuffers(1, &b);
+                glBindBuffer(GL_ARRAY_BUFFER, b);
+                glBufferData(GL_ARRAY_BUFFER, a.aBuffers[i].byteLength, a.aBuffers[i].aBin.data(), drawMode);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                aBufferMap[i] = b;
+            });
+        }
 
-            if (accIndIdx != NPOS)
+        for (size_t i = 0; i < a.aMeshes.size(); i++)
+        {
+            for (size_t j = 0; j < a.aMeshes[i].aPrimitives.size(); j++)
             {
-                auto& accInd = a.aAccessors[accIndIdx];
-                auto& bvInd = a.aBufferViews[accInd.bufferView];
-                nMesh.indType = accInd.componentType;
-                nMesh.meshData.eboSize = accInd.count;
-                nMesh.triangleCount = NPOS;
-
-                /* TODO: figure out how to reuse VBO data for index buffer (possible?) */
-                glGenBuffers(1, &nMesh.meshData.ebo);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, nMesh.meshData.ebo);
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER, bvInd.byteLength,
-                             &a.aBuffers[bvInd.buffer].aBin.data()[bvInd.byteOffset + accInd.byteOffset], drawMode);
+                auto* pPrim = &a.aMeshes[i].aPrimitives[j];
+                auto* pMesh = &this->aaMeshes[i][j];
+
+                /* vertex arrays reference buffer ids, so these go after the buffers */
+                q.push([&, pPrim, pMesh]{ setGLTFBuffers(a, *pPrim, aBufferMap, pMesh, drawMode); });
             }
-            else
+        }
+    }
+
+    /* EXT_mesh_gpu_instancing: bake instance matrices on the pool */
+    this->aInstances.resize(a.aNodes.size());
+    std::vector<std::vector<m4>> aaInstTms(a.aNodes.size());
+    for (size_t i = 0; i < a.aNodes.size(); i++)
+    {
+        auto& node = a.aNodes[i];
+        if (!node.isInstanced() || node.mesh == NPOS)
+            continue;
+
+        auto* pNode = &node;
+        auto* pTms = &aaInstTms[i];
+        auto* pDequant = &this->aTmDequant[node.mesh];
+        auto* pMeshBounds = &this->aMeshBounds[node.mesh];
+        auto* pInstBounds = &this->aInstances[i].bounds;
+
+        tp.submit([&, pNode, pTms, pDequant, pMeshBounds, pInstBounds]{
+            *pTms = getInstanceTms(a, *pNode);
+            for (size_t j = 0; j < pTms->size(); j++)
             {
-                nMesh.triangleCount = accPos.count;
+                auto& tm = (*pTms)[j];
+                AABB b = aabbTransform(*pMeshBounds, tm);
+                *pInstBounds = j == 0 ? b : aabbUnion(*pInstBounds, b);
+
+                tm *= *pDequant;
             }
+        });
+    }
 
-            constexpr size_t v3Size = sizeof(v3) / sizeof(f32);
-            constexpr size_t v2Size = sizeof(v2) / sizeof(f32);
+    /* this thread is the only gl submission stage, returns when every queued and promised job is done */
+    q.drain(c);
+    tp.wait();
 
-            /* if there are different VBO's for positions textures or normals,
-             * given gltf file should be considered harmful, and this will crash ofc */
-            nMesh.meshData.vbo = aBufferMap[bvPos.buffer];
-            glBindBuffer(GL_ARRAY_BUFFER, nMesh.meshData.vbo);
+    /* second stage: vertex arrays that reuse mesh buffers */
 
-            /* positions */
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, v3Size, static_cast<GLenum>(accPos.componentType), GL_FALSE,
-                                  bvPos.byteStride, reinterpret_cast<void*>(bvPos.byteOffset + accPos.byteOffset));
+    /* meshes referenced by more than one plain node get a second vertex array, queueDraw batches them into instanced draws.
+     * heap pools have one such array for all of their meshes */
+    std::vector<size_t> aMeshRefs(a.aMeshes.size());
+    for (auto& node : a.aNodes)
+        if (node.mesh != NPOS && !node.isInstanced())
+            aMeshRefs[node.mesh]++;
 
-            /* texture coords */
-            glEnableVertexAttribArray(1);
-            glVertexAttribPointer(1, v2Size, static_cast<GLenum>(accTex.componentType), GL_FALSE,
-                                  bvTex.byteStride, reinterpret_cast<void*>(bvTex.byteOffset + accTex.byteOffset));
+    this->aaBatchTms.resize(a.aMeshes.size());
+    this->aBatchDepths.resize(a.aMeshes.size());
+    q.push([&]{
+        for (size_t i = 0; i < a.aMeshes.size(); i++)
+        {
+            if (aMeshRefs[i] < 2)
+                continue;
 
-             /*normals */
-            if (accNormIdx != NPOS)
+            for (size_t j = 0; j < a.aMeshes[i].aPrimitives.size(); j++)
             {
-                auto& accNorm = a.aAccessors[accNormIdx];
-                auto& bvNorm = a.aBufferViews[accNorm.bufferView];
+                auto& e = this->aaMeshes[i][j];
+                if (e.meshData.range.valid())
+                {
+                    e.meshData.instVao = gpuHeap.instVao(gpuHeap.format(e.meshData.range));
+                    e.meshData.depthInstVao = gpuHeap.depthInstVao(gpuHeap.format(e.meshData.range));
+                    continue;
+                }
 
-                glEnableVertexAttribArray(2);
-                glVertexAttribPointer(2, v3Size, static_cast<GLenum>(accNorm.componentType), GL_FALSE,
-                                      bvNorm.byteStride, reinterpret_cast<void*>(accNorm.byteOffset + bvNorm.byteOffset));
+                glGenVertexArrays(1, &e.meshData.instVao);
+                glBindVertexArray(e.meshData.instVao);
+                if (e.meshData.ebo)
+                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, e.meshData.ebo);
+                setMeshAttributes(a, a.aMeshes[i].aPrimitives[j], e);
+                setInstanceAttributes(0);
             }
+        }
 
-            /* tangents */
-            if (accTanIdx != NPOS)
-            {
-                auto& accTan = a.aAccessors[accTanIdx];
-                auto& bvTan = a.aBufferViews[accTan.bufferView];
+        glBindVertexArray(0);
+    });
 
-                glEnableVertexAttribArray(3);
-                glVertexAttribPointer(3, v3Size, static_cast<GLenum>(accTan.componentType), GL_FALSE,
-                                      bvTan.byteStride, reinterpret_cast<void*>(accTan.byteOffset + bvTan.byteOffset));
-            }
+    for (size_t i = 0; i < a.aNodes.size(); i++)
+    {
+        auto& node = a.aNodes[i];
+        if (aaInstTms[i].empty())
+            continue;
 
-            glBindVertexArray(0);
-            c->unbindGlContext();
-            gl::mtxGlContext.unlock();
+        auto* pInst = &this->aInstances[i];
+        auto* pMesh = &a.aMeshes[node.mesh];
+        auto* pMeshes = &this->aaMeshes[node.mesh];
+        auto* pTms = &aaInstTms[i];
+
+        q.push([&, pInst, pMesh, pMeshes, pTms]{ setInstanceBuffers(a, *pMesh, *pMeshes, *pTms, pInst, drawMode); });
+    }
+
+    q.drain(c);
+
+    if (this->bQuantized)
+        LOG(OK, "'{}': quantized {} bytes of buffers into {} bytes\n", path, nOrigBytes, nQuantBytes);
+
+    /* textures are uploaded at this point */
+    for (size_t i = 0; i < a.aMeshes.size(); i++)
+    {
+        for (size_t j = 0; j < a.aMeshes[i].aPrimitives.size(); j++)
+        {
+            size_t accMatIdx = a.aMeshes[i].aPrimitives[j].material;
+            auto& nMesh = this->aaMeshes[i][j];
 
-            /* load textures */
             if (accMatIdx != NPOS)
             {
                 auto& mat = a.aMaterials[accMatIdx];
+                nMesh.bAlphaTest = mat.alphaMode != gltf::ALPHA_MODE::SOLID;
                 size_t baseColorSourceIdx = mat.pbrMetallicRoughness.baseColorTexture.index;
 
                 if (baseColorSourceIdx != NPOS)
@@ -451,275 +753,1208 @@ Model::loadGLTF(std::string_view path, GLint drawMode, GLint texMode, App* c)
                     size_t normTexIdx = a.aTextures[normalSourceIdx].source;
                     if (normTexIdx != NPOS)
                     {
-                        nMesh.meshData.materials.normal = aTex[normalSourceIdx];
+                        nMesh.meshData.materials.normal = aTex[normTexIdx];
                         nMesh.meshData.materials.normal.type = TEX_TYPE::NORMAL;
                     }
                 }
             }
-
-            aNMeshes.push_back(std::move(nMesh));
         }
-        this->aaMeshes.push_back(std::move(aNMeshes));
     }
 
     /* prevent destruction */
     for (auto& t : aTex)
         t.id = 0;
 
-    this->aTmIdxs = decltype(this->aTmIdxs)(sq(this->asset.aNodes.size()), {});
-    this->aTmCounters = decltype(this->aTmCounters)(this->asset.aNodes.size(), {});
+    this->flattenGraph();
+
+    if (flags & LOAD::STATIC_BATCH)
+        this->buildStaticBatches(c);
 }
 
-static void
-setBuffers(std::vector<Vertex>* verts, std::vector<GLuint>* inds, MeshData* m, GLint drawMode, App* c)
+/* world size of the cubic cells batches are split by, batches don't span cells so they can still be culled.
+ * about a room or a few arches of sponza */
+constexpr f32 STATIC_BATCH_CELL_SIZE = 5.0f;
+constexpr u32 STATIC_BATCH_MAX_CELLS = 256; /* per axis, 8 bits each in the group key */
+
+void
+Model::buildStaticBatches(App* c)
 {
-    /* TODO: use one buffer object (or drop OBJ since gltf is here) */
+    auto& a = this->asset;
+    this->aStaticNodes.assign(a.aNodes.size(), false);
 
-    std::lock_guard lock(gl::mtxGlContext);
+    /* node transforms relative to the model */
+    this->transforms.update(m4Iden());
 
-    c->bindGlContext();
+    struct Item
+    {
+        u32 node;
+        u32 prim;
+        AABB bounds;
+    };
 
-    auto vsData = verts->data();
-    auto inData = inds->data();
-
-    glGenVertexArrays(1, &m->vao);
-    glBindVertexArray(m->vao);
-
-    glGenBuffers(1, &m->ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, inds->size() * sizeof(*inData), inData, drawMode);
-
-    glGenBuffers(1, &m->vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
-    glBufferData(GL_ARRAY_BUFFER, verts->size() * sizeof(*vsData), vsData, drawMode);
-
-    constexpr size_t v3Size = sizeof(v3) / sizeof(f32);
-    constexpr size_t v2Size = sizeof(v2) / sizeof(f32);
-    /* positions */
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, v3Size, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-    /* texture coords */
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, v2Size, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(sizeof(f32) * v3Size));
-    /* normals */
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, v3Size, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(sizeof(f32) * (v3Size + v2Size)));
-    /* tangents */
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, v3Size, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(sizeof(f32) * (2*v3Size + v2Size)));
-    /* bitangents */
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, v3Size, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(sizeof(f32) * (3*v3Size + v2Size)));
+    std::vector<Item> aItems;
+    AABB total {};
+    for (u32 i : this->aMeshNodes)
+    {
+        auto& node = a.aNodes[i];
+        if (this->aInstances[i].count)
+            continue;
+
+        /* indices of other modes can't be concatenated */
+        bool bTriangles = true;
+        for (auto& prim : a.aMeshes[node.mesh].aPrimitives)
+            bTriangles &= prim.mode == gltf::PRIMITIVES::TRIANGLES;
+        if (!bTriangles)
+            continue;
+
+        const m4& tm = this->transforms.aWorld[this->aGraphPos[i]];
+        for (u32 j = 0; j < this->aaMeshes[node.mesh].size(); j++)
+        {
+            AABB b = aabbTransform(this->aaMeshes[node.mesh][j].bounds, tm);
+            total = aItems.empty() ? b : aabbUnion(total, b);
+            aItems.push_back({i, j, b});
+        }
+        this->aStaticNodes[i] = true;
+    }
 
-    glBindVertexArray(0);
+    if (aItems.empty())
+        return;
+
+    /* huge models get bigger cells rather than more bits */
+    v3 extent = total.max - total.min;
+    f32 cellSize = std::max(STATIC_BATCH_CELL_SIZE, std::max({extent.x, extent.y, extent.z}) / STATIC_BATCH_MAX_CELLS);
+
+    /* group by material, then by cell */
+    auto groupKey = [&](const Item& it) -> u64 {
+        auto& node = a.aNodes[it.node];
+        u64 material = a.aMeshes[node.mesh].aPrimitives[it.prim].material;
+        v3 center = (it.bounds.min + it.bounds.max) * 0.5f - total.min;
+        u64 cx = std::min(u32(center.x / cellSize), STATIC_BATCH_MAX_CELLS - 1);
+        u64 cy = std::min(u32(center.y / cellSize), STATIC_BATCH_MAX_CELLS - 1);
+        u64 cz = std::min(u32(center.z / cellSize), STATIC_BATCH_MAX_CELLS - 1);
+        return (material + 1) << 24 | cx << 16 | cy << 8 | cz;
+    };
+    std::stable_sort(aItems.begin(), aItems.end(), [&](const Item& l, const Item& r) { return groupKey(l) < groupKey(r); });
 
-    c->unbindGlContext();
-}
+    std::vector<Vertex> aVerts, aPrimVerts;
+    std::vector<GLuint> aInds, aPrimInds;
 
-void
-Model::draw(enum DRAW flags, Shader* sh, std::string_view svUniform, std::string_view svUniformM3Norm, const m4& tmGlobal)
-{
-    for (auto& m : this->aaMeshes)
+    for (size_t first = 0; first < aItems.size();)
     {
-        for (auto& e : m)
-        {
-            glBindVertexArray(e.meshData.vao);
+        size_t end = first;
+        u64 key = groupKey(aItems[first]);
+        while (end < aItems.size() && groupKey(aItems[end]) == key)
+            end++;
 
-            if (flags & DRAW::DIFF)
-                e.meshData.materials.diffuse.bind(GL_TEXTURE0);
-            if (flags & DRAW::NORM)
-                e.meshData.materials.normal.bind(GL_TEXTURE1);
+        aVerts.clear();
+        aInds.clear();
+        AABB bounds = aItems[first].bounds;
 
-            m4 m = m4Iden();
-            if (flags & DRAW::APPLY_TM)
-                m *= tmGlobal;
+        for (size_t k = first; k < end; k++)
+        {
+            auto& it = aItems[k];
+            auto& node = a.aNodes[it.node];
+            const m4& tm = this->transforms.aWorld[this->aGraphPos[it.node]];
+            m3 nm = m3Normal(tm);
+
+            readGLTFPrimitive(a, a.aMeshes[node.mesh].aPrimitives[it.prim], &aPrimVerts, &aPrimInds);
 
-            if (sh)
+            auto dir = [](const m3& m, const v3& v) { return v3Norm(m.v[0] * v.x + m.v[1] * v.y + m.v[2] * v.z); };
+            GLuint base = aVerts.size();
+            for (auto& v : aPrimVerts)
             {
-                sh->setM4(svUniform, m);
-                if (flags & DRAW::APPLY_NM) sh->setM3(svUniformM3Norm, m3Normal(m));
+                v4 p = tm * v4(v.pos.x, v.pos.y, v.pos.z, 1.0f);
+                aVerts.push_back({{p.x, p.y, p.z}, v.tex, dir(nm, v.norm), dir(tm, v.tan), dir(tm, v.bitan)});
             }
 
-            if (e.triangleCount != NPOS)
-                glDrawArrays(static_cast<GLenum>(e.mode), 0, e.triangleCount);
+            if (aPrimInds.empty())
+                for (GLuint i = 0; i < aPrimVerts.size(); i++)
+                    aInds.push_back(base + i);
             else
-                glDrawElements(static_cast<GLenum>(e.mode),
-                               e.meshData.eboSize,
-                               static_cast<GLenum>(e.indType),
-                               nullptr);
+                for (GLuint i : aPrimInds)
+                    aInds.push_back(base + i);
+
+            bounds = aabbUnion(bounds, it.bounds);
         }
-    }
-}
 
-void
-Model::drawGraph(enum DRAW flags,
-                 Shader* sh,
-                 std::string_view svUniform,
-                 std::string_view svUniformM3Norm,
-                 const m4& tmGlobal)
-{
-    auto& aNodes = this->asset.aNodes;
-    std::fill(this->aTmIdxs.begin(), this->aTmIdxs.end(), 0);
-    std::fill(this->aTmCounters.begin(), this->aTmCounters.end(), 0);
+        auto& src = this->aaMeshes[a.aNodes[aItems[first].node].mesh][aItems[first].prim];
+        Mesh batch {
+            .meshData {},
+            .indType = gltf::COMPONENT_TYPE::UNSIGNED_INT,
+            .mode = gltf::PRIMITIVES::TRIANGLES,
+            .triangleCount = NPOS,
+            .bounds = bounds,
+        };
+        batch.meshData.materials = src.meshData.materials;
+        batch.bAlphaTest = src.bAlphaTest;
+        batch.meshData.eboSize = aInds.size();
+        m4 tmDequant = m4Iden();
+
+        if (this->bQuantized)
+        {
+            v3 center {};
+            f32 scale = 1.0f;
+            getQuantizationBounds(bounds.min, bounds.max, &center, &scale);
+            tmDequant = getDequantTm(center, scale);
+            auto qp = quantizeVertices(aVerts, aInds, center, scale);
 
-    auto at = [&](int r, int c) -> int {
-        return r*aNodes.size() + c;
-    };
+            std::lock_guard lock(gl::mtxGlContext);
+            c->bindGlContext();
+            setQuantizedBuffers(qp, &batch);
+            c->unbindGlContext();
+        }
+        else
+        {
+            setBuffers(&aVerts, &aInds, &batch.meshData, c);
+        }
+
+        this->aStaticBatches.push_back(std::move(batch));
+        this->aStaticDequant.push_back(tmDequant);
+        first = end;
+    }
+
+    /* meshes used by merged nodes only are never drawn on their own, don't keep them in vram twice */
+    std::vector<bool> aMerged(this->aaMeshes.size(), false), aDrawn(this->aaMeshes.size(), false);
+    for (u32 i : this->aMeshNodes)
+        (this->aStaticNodes[i] ? aMerged : aDrawn)[a.aNodes[i].mesh] = true;
 
-    for (size_t i = 0; i < aNodes.size(); i++)
+    u32 nReleased = 0;
+    for (size_t i = 0; i < this->aaMeshes.size(); i++)
     {
-        auto& node = aNodes[i];
-        for (auto& ch : node.children)
-            aTmIdxs[at(ch, aTmCounters[ch]++)] = i; /* give each children it's parent's idx's */
+        if (!aMerged[i] || aDrawn[i])
+            continue;
 
-        if (node.mesh != NPOS)
+        for (auto& e : this->aaMeshes[i])
         {
-            m4 tm = tmGlobal;
-            qt rot = qtIden();
-            for (int j = 0; j < aTmCounters[i]; j++)
+            auto& o = e.meshData;
+            if (o.range.valid())
             {
-                /* collect each transformation from parent's map */
-                auto& n = aNodes[ aTmIdxs[at(i, j)] ];
-
-                tm = m4Scale(tm, n.scale);
-                rot *= n.rotation;
-                tm *= n.matrix;
+                gpuHeap.free(o.range);
             }
-            tm = m4Scale(tm, node.scale);
-            tm *= qtRot(rot * node.rotation);
-            tm = m4Translate(tm, node.translation);
-            tm *= node.matrix;
-
-            for (auto& e : this->aaMeshes[node.mesh])
+            else
             {
-                glBindVertexArray(e.meshData.vao);
-
-                if (flags & DRAW::DIFF)
-                    e.meshData.materials.diffuse.bind(GL_TEXTURE0);
-                if (flags & DRAW::NORM)
-                    e.meshData.materials.normal.bind(GL_TEXTURE1);
-
-                if (sh)
-                {
-                    sh->setM4(svUniform, tm);
-                    if (flags & DRAW::APPLY_NM) sh->setM3(svUniformM3Norm, m3Normal(tm));
-                }
-
-                if (e.triangleCount != NPOS)
-                    glDrawArrays(static_cast<GLenum>(e.mode), 0, e.triangleCount);
-                else
-                    glDrawElements(static_cast<GLenum>(e.mode),
-                                   e.meshData.eboSize,
-                                   static_cast<GLenum>(e.indType),
-                                   nullptr);
+                std::lock_guard lock(gl::mtxGlContext);
+                c->bindGlContext();
+                glDeleteVertexArrays(1, &o.vao);
+                glDeleteBuffers(1, &o.vbo);
+                glDeleteBuffers(1, &o.ebo);
+                if (o.instVao)
+                    glDeleteVertexArrays(1, &o.instVao);
+                c->unbindGlContext();
             }
+
+            /* bounds and material stay for the batches */
+            o.range = {};
+            o.vao = o.vbo = o.ebo = o.instVao = o.depthVao = o.depthInstVao = 0;
+            o.eboSize = 0;
+            nReleased++;
         }
     }
+
+    LOG(OK, "{} primitives merged into {} static batches, {} source primitives released\n", aItems.size(), this->aStaticBatches.size(), nReleased);
 }
 
-/*void*/
-/*Model::drawInstanced(GLsizei count)*/
-/*{*/
-/*    for (auto& aaMeshes : objects)*/
-/*        for (auto& mesh : aaMeshes)*/
-/*        {*/
-/*            glBindVertexArray(mesh.vao);*/
-/*            glDrawElementsInstanced(GL_TRIANGLES, mesh.eboSize, GL_UNSIGNED_INT, nullptr, count);*/
-/*        }*/
-/*}*/
-/**/
+static void
+setGLTFBuffers(const gltf::Asset& a, const gltf::Primitive& primitive, const std::vector<GLuint>& aBufferMap, Mesh* pMesh, GLint drawMode)
+{
+    auto& nMesh = *pMesh;
 
-Ubo::Ubo(size_t _size, GLint drawMode)
+    size_t accIndIdx = primitive.indices;
+    size_t accPosIdx = primitive.attributes.POSITION;
+
+    auto& accPos = a.aAccessors[accPosIdx];
+    auto& bvPos = a.aBufferViews[accPos.bufferView];
+
+    nMesh.mode = primitive.mode;
+
+    glGenVertexArrays(1, &nMesh.meshData.vao);
+    glBindVertexArray(nMesh.meshData.vao);
+
+    if (accIndIdx != NPOS)
+    {
+        auto& accInd = a.aAccessors[accIndIdx];
+        auto& bvInd = a.aBufferViews[accInd.bufferView];
+        nMesh.indType = accInd.componentType;
+        nMesh.meshData.eboSize = accInd.count;
+        nMesh.triangleCount = NPOS;
+
+        /* TODO: figure out how to reuse VBO data for index buffer (possible?) */
+        glGenBuffers(1, &nMesh.meshData.ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, nMesh.meshData.ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, bvInd.byteLength,
+                     &a.aBuffers[bvInd.buffer].aBin.data()[bvInd.byteOffset + accInd.byteOffset], drawMode);
+    }
+    else
+    {
+        nMesh.triangleCount = accPos.count;
+    }
+
+    /* if there are different VBO's for positions textures or normals,
+     * given gltf file should be considered harmful, and this will crash ofc */
+    nMesh.meshData.vbo = aBufferMap[bvPos.buffer];
+    setGLTFAttributes(a, primitive, nMesh.meshData.vbo);
+
+    glBindVertexArray(0);
+}
+
+/* sets vertex attributes of the primitive into the bound vertex array,
+ * component types and normalization come from accessors, so KHR_mesh_quantization data works as is */
+static void
+setGLTFAttributes(const gltf::Asset& a, const gltf::Primitive& primitive, GLuint vbo)
 {
-    createBuffer(_size, drawMode);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    auto setAttrib = [&](GLuint loc, size_t accIdx) -> void {
+        if (accIdx == NPOS)
+            return;
+
+        auto& acc = a.aAccessors[accIdx];
+        auto& bv = a.aBufferViews[acc.bufferView];
+
+        glEnableVertexAttribArray(loc);
+        glVertexAttribPointer(loc, gltf::accessorTypeComponents(acc.type), static_cast<GLenum>(acc.componentType),
+                              acc.normalized, bv.byteStride, reinterpret_cast<void*>(bv.byteOffset + acc.byteOffset));
+    };
+
+    setAttrib(0, primitive.attributes.POSITION);
+    setAttrib(1, primitive.attributes.TEXCOORD_0);
+    setAttrib(2, primitive.attributes.NORMAL);
+    setAttrib(3, primitive.attributes.TANGENT);
 }
 
-Ubo::~Ubo()
+static enum VERTEX_FORMAT
+quantizedFormat(bool bHalfTex)
 {
-    glDeleteBuffers(1, &id);
-    LOG(OK, "ubo '{}' deleted\n", id);
+    return bHalfTex ? VERTEX_FORMAT::QUANTIZED_HALF_TEX : VERTEX_FORMAT::QUANTIZED;
 }
 
-void
-Ubo::createBuffer(size_t _size, GLint drawMode)
+static void
+setMeshAttributes(const gltf::Asset& a, const gltf::Primitive& primitive, const Mesh& m)
 {
-    this->size = _size;
-    glGenBuffers(1, &this->id);
-    glBindBuffer(GL_UNIFORM_BUFFER, this->id);
-    glBufferData(GL_UNIFORM_BUFFER, _size, nullptr, drawMode);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    if (m.bQuantized)
+        setVertexFormatAttributes(quantizedFormat(m.bHalfTex), m.meshData.vbo);
+    else
+        setGLTFAttributes(a, primitive, m.meshData.vbo);
 }
 
-void
-Ubo::bindBlock(Shader* sh, std::string_view block, GLuint _point)
+static void
+setQuantizedBuffers(const QuantizedPrimitive& qp, Mesh* pMesh)
 {
-    this->point = _point;
-    GLuint index = glGetUniformBlockIndex(sh->id, block.data());
-    glUniformBlockBinding(sh->id, index, _point);
-    LOG(OK, "uniform block: '{}' at '{}', in shader '{}'\n", block, index, sh->id);
+    auto& nMesh = *pMesh;
+    auto fmt = quantizedFormat(qp.bHalfTex);
 
-    glBindBufferBase(GL_UNIFORM_BUFFER, _point, this->id);
-    /* or */
-    // glBindBufferRange(GL_UNIFORM_BUFFER, _point, this->id, 0, size);
+    nMesh.bQuantized = true;
+    nMesh.bHalfTex = qp.bHalfTex;
+
+    if (!qp.aIndices.empty())
+    {
+        nMesh.indType = qp.indType;
+        nMesh.meshData.eboSize = qp.nIndices;
+        nMesh.triangleCount = NPOS;
+    }
+    else
+    {
+        nMesh.triangleCount = qp.aVerts.size();
+    }
+
+    nMesh.meshData.range = gpuHeap.alloc(fmt, qp.aVerts.data(), qp.aVerts.size(), qp.aIndices.data(), qp.aIndices.size());
+    nMesh.meshData.vao = gpuHeap.vao(fmt);
+    nMesh.meshData.depthVao = gpuHeap.depthVao(fmt);
+    nMesh.meshData.vbo = gpuHeap.vbo(fmt);
+    nMesh.meshData.ebo = gpuHeap.ebo(fmt);
 }
 
-void
-Ubo::bufferData(void* pData, size_t offset, size_t _size)
+static s16
+toSnorm16(f32 f)
 {
-    glBindBuffer(GL_UNIFORM_BUFFER, this->id);
-    glBufferSubData(GL_UNIFORM_BUFFER, offset, _size, pData);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return static_cast<s16>(std::round(std::clamp(f, -1.0f, 1.0f) * 32767.0f));
 }
 
-Model
-getQuad(GLint drawMode)
+static u16
+toUnorm16(f32 f)
 {
-    f32 quadVertices[] {
-        -1.0f,  1.0f,  0.0f,  0.0f,  1.0f,
-        -1.0f, -1.0f,  0.0f,  0.0f,  0.0f,
-         1.0f, -1.0f,  0.0f,  1.0f,  0.0f,
-         1.0f,  1.0f,  0.0f,  1.0f,  1.0f,
-    };
-
-    GLuint quadIndices[] {
-        0, 1, 2, 0, 2, 3
-    };
+    return static_cast<u16>(std::round(std::clamp(f, 0.0f, 1.0f) * 65535.0f));
+}
 
-    Model q;
-    q.aaMeshes.resize(1);
-    q.aaMeshes.back().push_back({});
+/* round to nearest, values too small for a normal half are flushed to zero */
+static u16
+toHalf(f32 f)
+{
+    u32 x;
+    memcpy(&x, &f, sizeof(x));
 
-    glGenVertexArrays(1, &q.aaMeshes[0][0].meshData.vao);
-    glBindVertexArray(q.aaMeshes[0][0].meshData.vao);
+    u32 sign = (x >> 16) & 0x8000;
+    s32 exp = static_cast<s32>((x >> 23) & 0xff) - 127 + 15;
+    u32 mant = x & 0x7fffff;
 
-    glGenBuffers(1, &q.aaMeshes[0][0].meshData.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, q.aaMeshes[0][0].meshData.vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, drawMode);
+    if (exp <= 0)
+        return sign;
+    if (exp >= 31)
+        return sign | 0x7c00;
 
-    glGenBuffers(1, &q.aaMeshes[0][0].meshData.ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, q.aaMeshes[0][0].meshData.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quadIndices), quadIndices, drawMode);
-    q.aaMeshes[0][0].meshData.eboSize = LEN(quadIndices);
+    return sign | ((exp << 10) + ((mant + 0x1000) >> 13));
+}
 
-    constexpr size_t v3Size = sizeof(v3) / sizeof(f32);
-    constexpr size_t v2Size = sizeof(v2) / sizeof(f32);
-    constexpr size_t stride = 5 * sizeof(f32);
-    /* positions */
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, v3Size, GL_FLOAT, GL_FALSE, stride, (void*)0);
-    /* texture coords */
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, v2Size, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(f32) * v3Size));
+/* octahedral mapping of unit vector into two snorms */
+static void
+octEncode(const v3& v, s16* pOut)
+{
+    f32 l1 = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (l1 == 0.0f)
+    {
+        pOut[0] = pOut[1] = 0;
+        return;
+    }
 
-    glBindVertexArray(0);
+    f32 x = v.x / l1, y = v.y / l1;
+    if (v.z < 0.0f)
+    {
+        f32 ox = x;
+        x = (1.0f - std::abs(y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+        y = (1.0f - std::abs(ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+    }
 
-    LOG(OK, "quad '{}' created\n", q.aaMeshes[0][0].meshData.vao);
-    q.savedPath = "Quad";
-    return q;
+    pOut[0] = toSnorm16(x);
+    pOut[1] = toSnorm16(y);
+}
+
+static void
+getQuantizationBounds(const v3& min, const v3& max, v3* pCenter, f32* pScale)
+{
+    *pCenter = (min + max) * 0.5f;
+    /* same scale on every axis, so dequantization doesn't skew normals */
+    f32 scale = std::max({max.x - min.x, max.y - min.y, max.z - min.z}) * 0.5f;
+    *pScale = scale > 0.0f ? scale : 1.0f;
+}
+
+static void
+getQuantizationBounds(const std::vector<v3>& aPos, v3* pCenter, f32* pScale)
+{
+    v3 min {FLT_MAX, FLT_MAX, FLT_MAX};
+    v3 max {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (auto& p : aPos)
+    {
+        min = {std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z)};
+        max = {std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z)};
+    }
+
+    if (aPos.empty())
+        min = max = {};
+
+    getQuantizationBounds(min, max, pCenter, pScale);
+}
+
+static void
+getQuantizationBounds(const gltf::Asset& a, const gltf::Mesh& mesh, v3* pCenter, f32* pScale)
+{
+    v3 min {FLT_MAX, FLT_MAX, FLT_MAX};
+    v3 max {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (auto& prim : mesh.aPrimitives)
+    {
+        auto& acc = a.aAccessors[prim.attributes.POSITION];
+        min = {std::min(min.x, acc.min.VEC3.x), std::min(min.y, acc.min.VEC3.y), std::min(min.z, acc.min.VEC3.z)};
+        max = {std::max(max.x, acc.max.VEC3.x), std::max(max.y, acc.max.VEC3.y), std::max(max.z, acc.max.VEC3.z)};
+    }
+
+    getQuantizationBounds(min, max, pCenter, pScale);
+}
+
+static m4
+getDequantTm(const v3& center, f32 scale)
+{
+    return m4Scale(m4Translate(m4Iden(), center), scale);
+}
+
+static QuantizedPrimitive
+quantizeVertices(const std::vector<Vertex>& aVerts, const std::vector<GLuint>& aInds, const v3& center, f32 scale)
+{
+    QuantizedPrimitive qp {};
+    qp.aVerts.resize(aVerts.size());
+
+    for (auto& v : aVerts)
+        if (v.tex.x < 0.0f || v.tex.x > 1.0f || v.tex.y < 0.0f || v.tex.y > 1.0f)
+            qp.bHalfTex = true;
+
+    f32 invScale = 1.0f / scale;
+    for (size_t i = 0; i < aVerts.size(); i++)
+    {
+        auto& v = aVerts[i];
+        auto& q = qp.aVerts[i];
+
+        v3 p = (v.pos - center) * invScale;
+        q.pos[0] = toSnorm16(p.x);
+        q.pos[1] = toSnorm16(p.y);
+        q.pos[2] = toSnorm16(p.z);
+        q.pos[3] = v3Dot(v3Cross(v.norm, v.tan), v.bitan) < 0.0f ? -32767 : 32767;
+
+        if (qp.bHalfTex)
+        {
+            q.tex[0] = toHalf(v.tex.x);
+            q.tex[1] = toHalf(v.tex.y);
+        }
+        else
+        {
+            q.tex[0] = toUnorm16(v.tex.x);
+            q.tex[1] = toUnorm16(v.tex.y);
+        }
+
+        octEncode(v.norm, q.norm);
+        octEncode(v.tan, q.tan);
+    }
+
+    qp.nIndices = aInds.size();
+    if (aVerts.size() <= 0xffff + 1)
+    {
+        qp.indType = gltf::COMPONENT_TYPE::UNSIGNED_SHORT;
+        qp.aIndices.resize(aInds.size() * sizeof(u16));
+        auto* p = reinterpret_cast<u16*>(qp.aIndices.data());
+        for (size_t i = 0; i < aInds.size(); i++)
+            p[i] = static_cast<u16>(aInds[i]);
+    }
+    else
+    {
+        qp.indType = gltf::COMPONENT_TYPE::UNSIGNED_INT;
+        qp.aIndices.resize(aInds.size() * sizeof(u32));
+        memcpy(qp.aIndices.data(), aInds.data(), qp.aIndices.size());
+    }
+
+    return qp;
+}
+
+/* read everything into floats first, input may be any mix of float and KHR_mesh_quantization types */
+static void
+readGLTFPrimitive(const gltf::Asset& a, const gltf::Primitive& primitive, std::vector<Vertex>* pVerts, std::vector<GLuint>* pInds)
+{
+    auto& attr = primitive.attributes;
+    size_t nVerts = a.aAccessors[attr.POSITION].count;
+
+    auto& aVerts = *pVerts;
+    aVerts.resize(nVerts);
+    for (size_t i = 0; i < nVerts; i++)
+    {
+        auto& v = aVerts[i];
+        f32 tan[4] {0, 0, 0, 1};
+
+        v = {};
+        a.readAccessor(attr.POSITION, i, v.pos.e);
+        if (attr.TEXCOORD_0 != NPOS) a.readAccessor(attr.TEXCOORD_0, i, v.tex.e);
+        if (attr.NORMAL != NPOS) a.readAccessor(attr.NORMAL, i, v.norm.e);
+        if (attr.TANGENT != NPOS) a.readAccessor(attr.TANGENT, i, tan);
+
+        v.tan = {tan[0], tan[1], tan[2]};
+        v.bitan = v3Cross(v.norm, v.tan) * tan[3];
+    }
+
+    pInds->clear();
+    if (primitive.indices != NPOS)
+    {
+        auto& acc = a.aAccessors[primitive.indices];
+        pInds->resize(acc.count);
+        for (size_t i = 0; i < acc.count; i++)
+            (*pInds)[i] = a.readIndex(primitive.indices, i);
+    }
+}
+
+static QuantizedPrimitive
+quantizeGLTFPrimitive(const gltf::Asset& a, const gltf::Primitive& primitive, const v3& center, f32 scale)
+{
+    std::vector<Vertex> aVerts;
+    std::vector<GLuint> aInds;
+    readGLTFPrimitive(a, primitive, &aVerts, &aInds);
+
+    return quantizeVertices(aVerts, aInds, center, scale);
+}
+
+static std::vector<m4>
+getInstanceTms(const gltf::Asset& a, const gltf::Node& node)
+{
+    auto& inst = node.instancing;
+    size_t accIdx = inst.TRANSLATION != NPOS ? inst.TRANSLATION : inst.ROTATION != NPOS ? inst.ROTATION : inst.SCALE;
+    size_t count = a.aAccessors[accIdx].count;
+
+    std::vector<m4> aTms(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        v3 t {};
+        qt r = qtIden();
+        v3 s {1, 1, 1};
+
+        if (inst.TRANSLATION != NPOS) a.readAccessor(inst.TRANSLATION, i, t.e);
+        if (inst.ROTATION != NPOS) a.readAccessor(inst.ROTATION, i, r.p);
+        if (inst.SCALE != NPOS) a.readAccessor(inst.SCALE, i, s.e);
+
+        aTms[i] = m4TRS(t, r, s);
+    }
+
+    return aTms;
+}
+
+/* one extra vertex array per primitive: same attributes and indices plus per instance matrix */
+static void
+setInstanceBuffers(const gltf::Asset& a, const gltf::Mesh& mesh, const std::vector<Mesh>& aMeshes, const std::vector<m4>& aTms, Instances* pInst, GLint drawMode)
+{
+    auto& nInst = *pInst;
+    nInst.count = aTms.size();
+
+    glGenBuffers(1, &nInst.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, nInst.vbo);
+    glBufferData(GL_ARRAY_BUFFER, aTms.size() * sizeof(m4), aTms.data(), drawMode);
+
+    nInst.aVaos.resize(mesh.aPrimitives.size());
+    glGenVertexArrays(nInst.aVaos.size(), nInst.aVaos.data());
+
+    for (size_t i = 0; i < mesh.aPrimitives.size(); i++)
+    {
+        glBindVertexArray(nInst.aVaos[i]);
+
+        if (aMeshes[i].meshData.ebo)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, aMeshes[i].meshData.ebo);
+
+        setMeshAttributes(a, mesh.aPrimitives[i], aMeshes[i]);
+        setInstanceAttributes(nInst.vbo);
+    }
+
+    /* heap meshes also get position only arrays for depth passes */
+    if (!aMeshes.empty() && aMeshes.front().meshData.range.valid())
+    {
+        nInst.aDepthVaos.resize(mesh.aPrimitives.size());
+        glGenVertexArrays(nInst.aDepthVaos.size(), nInst.aDepthVaos.data());
+
+        for (size_t i = 0; i < mesh.aPrimitives.size(); i++)
+        {
+            auto fmt = gpuHeap.format(aMeshes[i].meshData.range);
+            glBindVertexArray(nInst.aDepthVaos[i]);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuHeap.ebo(fmt));
+            setPositionAttributes(fmt, gpuHeap.positionVbo(fmt));
+            setInstanceAttributes(nInst.vbo);
+        }
+    }
+
+    glBindVertexArray(0);
+}
+
+/* per instance mat4 into the bound vertex array, takes four consecutive locations, one column each.
+ * with vbo 0 pointers are left for the render queue to set at submit */
+static void
+setInstanceAttributes(GLuint vbo)
+{
+    if (vbo)
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    for (GLuint c = 0; c < 4; c++)
+    {
+        glEnableVertexAttribArray(INSTANCE_ATTRIB_LOC + c);
+        if (vbo)
+            glVertexAttribPointer(INSTANCE_ATTRIB_LOC + c, 4, GL_FLOAT, GL_FALSE, sizeof(m4), reinterpret_cast<void*>(sizeof(v4) * c));
+        glVertexAttribDivisor(INSTANCE_ATTRIB_LOC + c, 1);
+    }
+}
+
+static void
+setBuffers(std::vector<Vertex>* verts, std::vector<GLuint>* inds, MeshData* m, App* c)
+{
+    std::lock_guard lock(gl::mtxGlContext);
+
+    c->bindGlContext();
+
+    m->range = gpuHeap.alloc(VERTEX_FORMAT::FULL, verts->data(), verts->size(), inds->data(), inds->size() * sizeof(GLuint));
+    m->vao = gpuHeap.vao(VERTEX_FORMAT::FULL);
+    m->depthVao = gpuHeap.depthVao(VERTEX_FORMAT::FULL);
+    m->vbo = gpuHeap.vbo(VERTEX_FORMAT::FULL);
+    m->ebo = gpuHeap.ebo(VERTEX_FORMAT::FULL);
+
+    c->unbindGlContext();
+}
+
+static DrawData
+makeDrawData(const m4& tm, const m3& nm, bool bQuantized)
+{
+    DrawData d {};
+    d.tm = tm;
+    for (int c = 0; c < 3; c++)
+        d.nm[c] = {nm.e[c][0], nm.e[c][1], nm.e[c][2], 0.0f};
+    d.bQuantized = bQuantized;
+
+    return d;
+}
+
+void
+Model::prepareDraw(UboRing* pRing, const m4& tmGlobal)
+{
+    if (this->bDrawListGraph || memcmp(&tmGlobal, &this->tmLastGlobal, sizeof(m4)) != 0)
+    {
+        this->tmLastGlobal = tmGlobal;
+        this->bDrawListGraph = false;
+        this->bDrawListValid = false;
+    }
+
+    this->pushDrawList(pRing);
+}
+
+void
+Model::prepareDrawGraph(UboRing* pRing, const m4& tmGlobal, ThreadPool* pTp)
+{
+    if (!this->bDrawListGraph)
+    {
+        this->bDrawListGraph = true;
+        this->bDrawListValid = false;
+    }
+
+    /* invalidates the draw list if anything moved */
+    this->updateTransforms(tmGlobal, pTp);
+    this->pushDrawList(pRing);
+}
+
+/* retained draw data is copied into the ring as one block, entries keep their slots */
+void
+Model::pushDrawList(UboRing* pRing)
+{
+    u32 stride = (sizeof(DrawData) + pRing->align - 1) / pRing->align * pRing->align;
+    if (!this->bDrawListValid || stride != this->drawStride)
+    {
+        this->drawStride = stride;
+        this->compileDrawList();
+    }
+
+    this->pDrawRing = pRing;
+    this->drawBase = pRing->push(this->aDrawDataCache.data(), this->aDrawDataCache.size());
+}
+
+/* flattens meshes (or the node graph) into RetainedDraw entries with world bounds and per draw data,
+ * so that queueing a pass is one loop over a compact array */
+void
+Model::compileDrawList()
+{
+    auto& aNodes = this->asset.aNodes;
+
+    this->aRetained.clear();
+    this->aRetainedTms.clear();
+    this->aDrawDataCache.clear();
+
+    auto pushData = [&](const DrawData& d) -> u32 {
+        u32 off = this->aDrawDataCache.size();
+        this->aDrawDataCache.resize(off + this->drawStride);
+        memcpy(&this->aDrawDataCache[off], &d, sizeof(d));
+        return off / this->drawStride;
+    };
+
+    auto pushStatic = [&](const Mesh& e, const m4& tmDequant) {
+        u32 slot = pushData(makeDrawData(this->tmLastGlobal * tmDequant, m3Normal(this->tmLastGlobal), this->bQuantized));
+        this->aRetained.push_back({aabbTransform(e.bounds, this->tmLastGlobal), &e, e.meshData.vao, e.meshData.depthVao, slot, 1, -1, 0});
+    };
+
+    if (!this->bDrawListGraph)
+    {
+        /* sources of static batches are released, the batches stand in for them */
+        for (size_t i = 0; i < this->aaMeshes.size(); i++)
+            for (auto& e : this->aaMeshes[i])
+                if (e.meshData.vao)
+                    pushStatic(e, this->aTmDequant[i]);
+        for (size_t b = 0; b < this->aStaticBatches.size(); b++)
+            pushStatic(this->aStaticBatches[b], this->aStaticDequant[b]);
+
+        this->bDrawListValid = true;
+        return;
+    }
+
+    /* world matrices of batched draws are per instance */
+    u32 batchSlot = pushData(makeDrawData(m4Iden(), m3Iden(), this->bQuantized));
+
+    for (u32 i : this->aMeshNodes)
+    {
+        if (this->isStaticNode(i))
+            continue;
+
+        auto& node = aNodes[i];
+        const m4& tm = this->transforms.aWorld[this->aGraphPos[i]];
+
+        GLsizei nInstances = this->aInstances[i].count;
+        auto& aMeshes = this->aaMeshes[node.mesh];
+        bool bBatched = !nInstances && !aMeshes.empty() && aMeshes.front().meshData.instVao;
+
+        /* repeated meshes are gathered per pass and queued as one instanced packet */
+        if (bBatched)
+        {
+            this->aRetained.push_back({aabbTransform(this->aMeshBounds[node.mesh], tm), nullptr, 0, 0, batchSlot, 0,
+                                       static_cast<s32>(node.mesh), static_cast<u32>(this->aRetainedTms.size())});
+            this->aRetainedTms.push_back(tm * this->aTmDequant[node.mesh]);
+            continue;
+        }
+
+        /* instance matrices already have dequantization applied */
+        u32 slot = pushData(makeDrawData(nInstances ? tm : tm * this->aTmDequant[node.mesh], this->aNormalTms[i], this->bQuantized));
+
+        /* instanced nodes are culled as a whole */
+        AABB nodeBox = nInstances ? aabbTransform(this->aInstances[i].bounds, tm) : AABB {};
+        for (size_t j = 0; j < aMeshes.size(); j++)
+        {
+            auto& e = aMeshes[j];
+            if (nInstances)
+            {
+                auto& inst = this->aInstances[i];
+                GLuint depthVao = inst.aDepthVaos.empty() ? 0 : inst.aDepthVaos[j];
+                this->aRetained.push_back({nodeBox, &e, inst.aVaos[j], depthVao, slot, nInstances, -1, 0});
+            }
+            else this->aRetained.push_back({aabbTransform(e.bounds, tm), &e, e.meshData.vao, e.meshData.depthVao, slot, 1, -1, 0});
+        }
+    }
+
+    for (size_t b = 0; b < this->aStaticBatches.size(); b++)
+        pushStatic(this->aStaticBatches[b], this->aStaticDequant[b]);
+
+    this->bDrawListValid = true;
+}
+
+static inline f32
+distanceTo(const AABB& box, const v3& eye)
+{
+    return v3Length((box.min + box.max) * 0.5f - eye);
+}
+
+static inline bool
+passDrawsMesh(const RenderPass& pass, const Mesh& e)
+{
+    if (pass.flags & DRAW::SKIP_ALPHA_TEST) return !e.bAlphaTest;
+    if (pass.flags & DRAW::ONLY_ALPHA_TEST) return e.bAlphaTest;
+    return true;
+}
+
+/* draw list comes from the last prepareDraw or prepareDrawGraph */
+void
+Model::queueDraw(RenderQueue* pQueue, const RenderPass& pass)
+{
+    for (auto& r : this->aRetained)
+    {
+        u32 nPrimitives = 0;
+        if (r.batch < 0)
+            nPrimitives = passDrawsMesh(pass, *r.pMesh);
+        else
+            for (auto& e : this->aaMeshes[r.batch])
+                nPrimitives += passDrawsMesh(pass, e);
+
+        if (nPrimitives == 0)
+            continue;
+
+        if ((pass.cullRange > 0.0f && !sphereTestAABB(pass.eye, pass.cullRange, r.box)) ||
+            (pass.pFrustum && !frustumTestAABB(*pass.pFrustum, r.box)))
+        {
+            drawStats.culled += nPrimitives;
+            continue;
+        }
+        drawStats.visible += nPrimitives;
+
+        f32 depth = distanceTo(r.box, pass.eye);
+        if (r.batch >= 0)
+        {
+            auto& aTms = this->aaBatchTms[r.batch];
+            this->aBatchDepths[r.batch] = aTms.empty() ? depth : std::min(this->aBatchDepths[r.batch], depth);
+            aTms.push_back(this->aRetainedTms[r.tm]);
+            continue;
+        }
+
+        GLuint vao = (pass.flags & DRAW::DEPTH) && r.depthVao ? r.depthVao : r.vao;
+        DrawPacket p {r.pMesh, this->pDrawRing, pass.pShader->id, vao, this->drawBase + r.slot * this->drawStride, r.nInstances, -1, pass.flags};
+        pQueue->push(pass, p, depth);
+    }
+
+    this->queueBatches(pQueue, pass);
+}
+
+/* depth first order: each subtree is one contiguous range that starts with its root */
+void
+Model::flattenGraph()
+{
+    auto& aNodes = this->asset.aNodes;
+    size_t nNodes = aNodes.size();
+
+    std::vector<bool> aHasParent(nNodes);
+    for (auto& node : aNodes)
+        for (auto ch : node.children)
+            aHasParent[ch] = true;
+
+    this->aGraphOrder.clear();
+    this->aGraphOrder.reserve(nNodes);
+    this->aGraphSubtreeEnds.assign(nNodes, 0);
+    this->aGraphPos.assign(nNodes, 0);
+    this->transforms = {};
+    this->transforms.resize(nNodes);
+
+    struct Entry { u32 node; s32 parentPos; bool bExit; };
+    std::vector<Entry> stack;
+
+    for (size_t r = 0; r < nNodes; r++)
+    {
+        if (aHasParent[r])
+            continue;
+
+        stack.push_back({static_cast<u32>(r), -1, false});
+        while (!stack.empty())
+        {
+            auto e = stack.back();
+            stack.pop_back();
+
+            if (e.bExit)
+            {
+                this->aGraphSubtreeEnds[this->aGraphPos[e.node]] = this->aGraphOrder.size();
+                continue;
+            }
+
+            u32 pos = this->aGraphOrder.size();
+            this->aGraphOrder.push_back(e.node);
+            this->aGraphPos[e.node] = pos;
+            this->transforms.setParent(pos, e.parentPos);
+
+            stack.push_back({e.node, 0, true});
+            auto& aChildren = aNodes[e.node].children;
+            for (auto it = aChildren.rbegin(); it != aChildren.rend(); ++it)
+                stack.push_back({static_cast<u32>(*it), static_cast<s32>(pos), false});
+        }
+    }
+
+    /* either matrix or trs is set, the other one stays identity */
+    const m4 tmIden = m4Iden();
+    for (u32 pos = 0; pos < this->aGraphOrder.size(); pos++)
+    {
+        auto& node = aNodes[this->aGraphOrder[pos]];
+        this->transforms.set(pos, node.translation, node.rotation, node.scale);
+        if (memcmp(&node.matrix, &tmIden, sizeof(m4)) != 0)
+            this->transforms.setMatrix(pos, node.matrix);
+    }
+
+    this->aMeshNodes.clear();
+    for (u32 i = 0; i < nNodes; i++)
+        if (aNodes[i].mesh != NPOS)
+            this->aMeshNodes.push_back(i);
+
+    this->aNormalTms.assign(nNodes, m3Iden());
+    this->bGraphValid = false;
+}
+
+void
+Model::setNodeTransform(size_t node, const v3& translation, const qt& rotation, const v3& scale)
+{
+    auto& n = this->asset.aNodes[node];
+    n.translation = translation;
+    n.rotation = rotation;
+    n.scale = scale;
+
+    this->transforms.set(this->aGraphPos[node], translation, rotation, scale);
+    this->aDirtyNodes.push_back(node);
+}
+
+/* recomputes world and normal matrices of dirty subtrees only */
+void
+Model::updateTransforms(const m4& tmGlobal, ThreadPool* pTp)
+{
+    auto& aNodes = this->asset.aNodes;
+
+    /* everything depends on the global transform */
+    if (!this->bGraphValid || memcmp(&tmGlobal, &this->tmLastGlobal, sizeof(m4)) != 0)
+    {
+        this->tmLastGlobal = tmGlobal;
+        this->bGraphValid = true;
+        this->bDrawListValid = false;
+        this->aDirtyNodes.clear();
+
+        this->transforms.update(tmGlobal, pTp);
+        for (u32 i : this->aMeshNodes)
+            this->aNormalTms[i] = m3Normal(this->transforms.aWorld[this->aGraphPos[i]]);
+
+        return;
+    }
+
+    if (this->aDirtyNodes.empty())
+        return;
+
+    this->bDrawListValid = false;
+    for (auto& n : this->aDirtyNodes)
+        n = this->aGraphPos[n];
+    std::sort(this->aDirtyNodes.begin(), this->aDirtyNodes.end());
+
+    u32 end = 0;
+    for (u32 first : this->aDirtyNodes)
+    {
+        /* already covered by a dirty ancestor */
+        if (first < end)
+            continue;
+
+        end = this->aGraphSubtreeEnds[first];
+        this->transforms.updateRange(first, end, tmGlobal);
+
+        for (u32 pos = first; pos < end; pos++)
+        {
+            u32 i = this->aGraphOrder[pos];
+            if (aNodes[i].mesh != NPOS)
+                this->aNormalTms[i] = m3Normal(this->transforms.aWorld[pos]);
+        }
+    }
+
+    this->aDirtyNodes.clear();
+}
+
+/* one instanced packet per (mesh, material) group of nodes collected by queueDraw */
+void
+Model::queueBatches(RenderQueue* pQueue, const RenderPass& pass)
+{
+    for (size_t i = 0; i < this->aaBatchTms.size(); i++)
+    {
+        auto& aTms = this->aaBatchTms[i];
+        if (aTms.empty())
+            continue;
+
+        s32 first = pQueue->pushInstances(aTms.data(), aTms.size());
+        for (auto& e : this->aaMeshes[i])
+        {
+            if (!passDrawsMesh(pass, e))
+                continue;
+
+            GLuint vao = (pass.flags & DRAW::DEPTH) && e.meshData.depthInstVao ? e.meshData.depthInstVao : e.meshData.instVao;
+
+            /* identity draw data is the first slot of graph draw lists */
+            DrawPacket p {&e, this->pDrawRing, pass.pShader->id, vao, this->drawBase,
+                          static_cast<GLsizei>(aTms.size()), first, pass.flags};
+            pQueue->push(pass, p, this->aBatchDepths[i]);
+        }
+
+        aTms.clear();
+    }
+}
+
+void
+drawMesh(const Mesh& e, GLsizei nInstances)
+{
+    /* zero for meshes outside of the heap */
+    GLint baseVertex = gpuHeap.baseVertex(e.meshData.range);
+    void* pIndices = reinterpret_cast<void*>(gpuHeap.indexOffset(e.meshData.range));
+
+    if (nInstances > 1)
+    {
+        if (e.triangleCount != NPOS)
+            glDrawArraysInstanced(static_cast<GLenum>(e.mode), baseVertex, e.triangleCount, nInstances);
+        else
+            glDrawElementsInstancedBaseVertex(static_cast<GLenum>(e.mode),
+                                              e.meshData.eboSize,
+                                              static_cast<GLenum>(e.indType),
+                                              pIndices,
+                                              nInstances,
+                                              baseVertex);
+    }
+    else
+    {
+        if (e.triangleCount != NPOS)
+            glDrawArrays(static_cast<GLenum>(e.mode), baseVertex, e.triangleCount);
+        else
+            glDrawElementsBaseVertex(static_cast<GLenum>(e.mode),
+                                     e.meshData.eboSize,
+                                     static_cast<GLenum>(e.indType),
+                                     pIndices,
+                                     baseVertex);
+    }
+
+    /* everything is drawn as triangle lists */
+    u64 nVertices = e.triangleCount != NPOS ? e.triangleCount : e.meshData.eboSize;
+    drawStats.drawCalls++;
+    drawStats.instances += nInstances;
+    drawStats.triangles += nVertices / 3 * nInstances;
+}
+
+/* shaders read per instance matrix from INSTANCE_ATTRIB_LOC, vertex arrays without it get identity from the current generic values */
+void
+setInstanceAttribDefaults()
+{
+    for (GLuint c = 0; c < 4; c++)
+    {
+        f32 col[4] {};
+        col[c] = 1.0f;
+        glVertexAttrib4fv(INSTANCE_ATTRIB_LOC + c, col);
+    }
+}
+
+Ubo::Ubo(size_t _size, GLint drawMode)
+{
+    createBuffer(_size, drawMode);
+}
+
+Ubo::~Ubo()
+{
+    glDeleteBuffers(1, &id);
+    LOG(OK, "ubo '{}' deleted\n", id);
+}
+
+void
+Ubo::createBuffer(size_t _size, GLint drawMode)
+{
+    this->size = _size;
+    glGenBuffers(1, &this->id);
+    glBindBuffer(GL_UNIFORM_BUFFER, this->id);
+    glBufferData(GL_UNIFORM_BUFFER, _size, nullptr, drawMode);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void
+Ubo::bindBlock(Shader* sh, std::string_view block, GLuint _point)
+{
+    this->point = _point;
+    GLuint index = glGetUniformBlockIndex(sh->id, block.data());
+    glUniformBlockBinding(sh->id, index, _point);
+    LOG(OK, "uniform block: '{}' at '{}', in shader '{}'\n", block, index, sh->id);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, _point, this->id);
+    /* or */
+    // glBindBufferRange(GL_UNIFORM_BUFFER, _point, this->id, 0, size);
+}
+
+void
+Ubo::bufferData(void* pData, size_t offset, size_t _size)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, this->id);
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, _size, pData);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+UboRing::~UboRing()
+{
+    for (auto& f : this->aFences)
+        if (f) glDeleteSync(f);
+
+    if (this->id)
+    {
+        glDeleteBuffers(1, &this->id);
+        LOG(OK, "ubo ring '{}' deleted\n", this->id);
+    }
+}
+
+void
+UboRing::createBuffer(u32 _regionSize)
+{
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &this->align);
+    this->regionSize = _regionSize;
+
+    glGenBuffers(1, &this->id);
+    glBindBuffer(GL_UNIFORM_BUFFER, this->id);
+    glBufferData(GL_UNIFORM_BUFFER, this->regionSize * NFRAMES, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void
+UboRing::beginFrame()
+{
+    this->region = (this->region + 1) % NFRAMES;
+    this->aStaging.clear();
+
+    GLsync& fence = this->aFences[this->region];
+    if (fence)
+    {
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
+
+u32
+UboRing::push(const void* pData, u32 size)
+{
+    u32 off = this->aStaging.size();
+    u32 stride = (size + this->align - 1) / this->align * this->align;
+
+    this->aStaging.resize(off + stride);
+    memcpy(&this->aStaging[off], pData, size);
+
+    return off;
+}
+
+void
+UboRing::upload()
+{
+    if (this->aStaging.empty())
+        return;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, this->id);
+
+    if (this->aStaging.size() > this->regionSize)
+    {
+        /* orphans the old storage, so pending fences don't matter anymore */
+        this->regionSize = this->aStaging.size() + this->aStaging.size() / 2;
+        this->regionSize = (this->regionSize + this->align - 1) / this->align * this->align;
+        glBufferData(GL_UNIFORM_BUFFER, this->regionSize * NFRAMES, nullptr, GL_STREAM_DRAW);
+        LOG(OK, "ubo ring '{}' grown to {} bytes per frame\n", this->id, this->regionSize);
+    }
+
+    /* the fence from beginFrame guarantees this region is no longer read */
+    void* p = glMapBufferRange(GL_UNIFORM_BUFFER, this->regionSize * this->region, this->aStaging.size(),
+                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    memcpy(p, this->aStaging.data(), this->aStaging.size());
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void
+UboRing::endFrame()
+{
+    this->aFences[this->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void
+UboRing::bindRange(GLuint point, u32 offset, u32 size) const
+{
+    gl::bindUniformRange(point, this->id, this->regionSize * this->region + offset, size);
+}
+
+void
+UboRing::bindBlock(Shader* sh, std::string_view block, GLuint point)
+{
+    GLuint index = glGetUniformBlockIndex(sh->id, block.data());
+    glUniformBlockBinding(sh->id, index, point);
+    LOG(OK, "uniform block: '{}' at '{}', in shader '{}'\n", block, index, sh->id);
+}
+
+/* single mesh model with its data in the heap */
+static Model
+getHeapModel(enum VERTEX_FORMAT fmt, const f32* pVerts, u32 nVerts, const GLuint* pIndices, u32 nIndices)
+{
+    Model q;
+    q.aaMeshes.resize(1);
+    q.aTmDequant.resize(1, m4Iden());
+    q.aaMeshes.back().push_back({});
+
+    auto& e = q.aaMeshes[0][0];
+    e.indType = gltf::COMPONENT_TYPE::UNSIGNED_INT;
+    e.mode = gltf::PRIMITIVES::TRIANGLES;
+    e.triangleCount = nIndices ? NPOS : nVerts;
+    e.meshData.eboSize = nIndices;
+    e.meshData.range = gpuHeap.alloc(fmt, pVerts, nVerts, pIndices, nIndices * sizeof(GLuint));
+    e.meshData.vao = gpuHeap.vao(fmt);
+    e.meshData.depthVao = gpuHeap.depthVao(fmt);
+    e.meshData.vbo = gpuHeap.vbo(fmt);
+    e.meshData.ebo = gpuHeap.ebo(fmt);
+
+    return q;
 }
 
 Model
-getPlane(GLint drawMode)
+getQuad()
+{
+    f32 quadVertices[] {
+        -1.0f,  1.0f,  0.0f,  0.0f,  1.0f,
+        -1.0f, -1.0f,  0.0f,  0.0f,  0.0f,
+         1.0f, -1.0f,  0.0f,  1.0f,  0.0f,
+         1.0f,  1.0f,  0.0f,  1.0f,  1.0f,
+    };
+
+    GLuint quadIndices[] {
+        0, 1, 2, 0, 2, 3
+    };
+
+    Model q = getHeapModel(VERTEX_FORMAT::POS_TEX, quadVertices, LEN(quadVertices) / 5, quadIndices, LEN(quadIndices));
+
+    LOG(OK, "quad '{}' created\n", q.aaMeshes[0][0].meshData.range.id);
+    q.savedPath = "Quad";
+    return q;
+}
+
+Model
+getPlane()
 {
     f32 planeVertices[] {
         /* positions            texcoords   normals          */
@@ -732,52 +1967,28 @@ getPlane(GLint drawMode)
          25.0f, -0.5f, -25.0f,  25.0f, 25.0f,  0.0f, 1.0f, 0.0f 
     };
 
-    Model q;
-    q.aaMeshes.resize(1);
-    q.aaMeshes.back().push_back({});
-
-    glGenVertexArrays(1, &q.aaMeshes[0][0].meshData.vao);
-    glBindVertexArray(q.aaMeshes[0][0].meshData.vao);
-
-    glGenBuffers(1, &q.aaMeshes[0][0].meshData.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, q.aaMeshes[0][0].meshData.vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(planeVertices), planeVertices, drawMode);
-
-    constexpr size_t v3Size = sizeof(v3) / sizeof(f32);
-    constexpr size_t v2Size = sizeof(v2) / sizeof(f32);
-    constexpr size_t stride = 8 * sizeof(f32);
-    /* positions */
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, v3Size, GL_FLOAT, GL_FALSE, stride, (void*)0);
-    /* texture coords */
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, v2Size, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(f32) * v3Size));
-    /* normals */
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, v3Size, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(f32) * (v3Size + v2Size)));
-
-    glBindVertexArray(0);
+    Model q = getHeapModel(VERTEX_FORMAT::POS_TEX_NORM, planeVertices, LEN(planeVertices) / 8, nullptr, 0);
 
-    LOG(OK, "plane '{}' created\n", q.aaMeshes[0][0].meshData.vao);
+    LOG(OK, "plane '{}' created\n", q.aaMeshes[0][0].meshData.range.id);
     return q;
 }
 
 void
 drawQuad(const Model& q)
 {
-    glBindVertexArray(q.aaMeshes[0][0].meshData.vao);
-    glDrawElements(GL_TRIANGLES, q.aaMeshes[0][0].meshData.eboSize, GL_UNSIGNED_INT, nullptr);
+    gl::bindVertexArray(q.aaMeshes[0][0].meshData.vao);
+    drawMesh(q.aaMeshes[0][0], 1);
 }
 
 void
 drawPlane(const Model& q)
 {
-    glBindVertexArray(q.aaMeshes[0][0].meshData.vao);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    gl::bindVertexArray(q.aaMeshes[0][0].meshData.vao);
+    drawMesh(q.aaMeshes[0][0], 1);
 }
 
 Model
-getCube(GLint drawMode)
+getCube()
 {
     float cubeVertices[] {
         /* back face */
@@ -824,41 +2035,17 @@ getCube(GLint drawMode)
         -1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 0.0f  /* bottom-left */
     };
 
-    Model q;
-    q.aaMeshes.resize(1);
-
-    glGenVertexArrays(1, &q.aaMeshes[0][0].meshData.vao);
-    glBindVertexArray(q.aaMeshes[0][0].meshData.vao);
-
-    glGenBuffers(1, &q.aaMeshes[0][0].meshData.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, q.aaMeshes[0][0].meshData.vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, drawMode);
-
-    constexpr size_t v3Size = sizeof(v3) / sizeof(f32);
-    constexpr size_t v2Size = sizeof(v2) / sizeof(f32);
-    constexpr size_t stride = 8 * sizeof(f32);
-
-    /* positions */
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, v3Size, GL_FLOAT, GL_FALSE, stride, (void*)0);
-    /* texture coords */
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, v2Size, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(f32) * v3Size));
-    /* normals */
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, v3Size, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(f32) * (v3Size + v2Size)));
-
-    glBindVertexArray(0);
+    Model q = getHeapModel(VERTEX_FORMAT::POS_TEX_NORM, cubeVertices, LEN(cubeVertices) / 8, nullptr, 0);
 
-    LOG(OK, "cube '{}' created\n", q.aaMeshes[0][0].meshData.vao);
+    LOG(OK, "cube '{}' created\n", q.aaMeshes[0][0].meshData.range.id);
     return q;
 }
 
 void
 drawCube(const Model& q)
 {
-    glBindVertexArray(q.aaMeshes[0][0].meshData.vao);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    gl::bindVertexArray(q.aaMeshes[0][0].meshData.vao);
+    drawMesh(q.aaMeshes[0][0], 1);
 }
 
 static void
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <cstddef>
 #include <functional>
 
 #include "gltf/gltf.hh"
 #include "gmath.hh"
+#include "gpuheap.hh"
 #include "shader.hh"
 #include "texture.hh"
+#include "transforms.hh"
 #include "app.hh"
 
 enum class DRAW : int
@@ -13,8 +16,10 @@ enum class DRAW : int
     NONE     = 0,
     DIFF     = 1,      /* bind diffuse textures */
     NORM     = 1 << 1, /* bind normal textures */
-    APPLY_TM = 1 << 2, /* apply transformation matrix */
-    APPLY_NM = 1 << 3, /* generate and apply normal matrix */
+    APPLY_TM = 1 << 2, /* bind per draw data (model and normal matrices) prepared for this frame */
+    DEPTH    = 1 << 3, /* position only vertex arrays where the mesh has them, for depth and shadow passes */
+    SKIP_ALPHA_TEST = 1 << 4, /* leave out meshes with Mesh::bAlphaTest */
+    ONLY_ALPHA_TEST = 1 << 5, /* only those */
     ALL      = INT_MAX
 };
 
@@ -36,6 +41,25 @@ operator^(enum DRAW l, enum DRAW r)
     return static_cast<enum DRAW>(static_cast<int>(l) ^ static_cast<int>(r));
 }
 
+enum class LOAD : int
+{
+    NONE     = 0,
+    QUANTIZE     = 1,      /* pack vertices into QuantizedVertex and indices into 16 bits when possible */
+    STATIC_BATCH = 1 << 1, /* gltf: merge triangles of plain nodes per material and spatial cell, merged nodes ignore setNodeTransform */
+};
+
+static inline bool
+operator&(enum LOAD l, enum LOAD r)
+{
+    return static_cast<int>(l) & static_cast<int>(r);
+}
+
+static inline enum LOAD
+operator|(enum LOAD l, enum LOAD r)
+{
+    return static_cast<enum LOAD>(static_cast<int>(l) | static_cast<int>(r));
+}
+
 struct FacePositions
 {
     int x, y, z;
@@ -64,6 +88,44 @@ struct Ubo
     void bufferData(void* data, size_t offset, size_t _size);
 };
 
+/* per frame uniform data packed into one upload, frames rotate through regions guarded by fences */
+struct UboRing
+{
+    static constexpr u32 NFRAMES = 3;
+
+    GLuint id = 0;
+    u32 regionSize = 0;
+    u32 region = 0;
+    GLint align = 256; /* GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT */
+    GLsync aFences[NFRAMES] {};
+    std::vector<u8> aStaging;
+
+    UboRing() = default;
+    ~UboRing();
+
+    void createBuffer(u32 _regionSize);
+    void beginFrame(); /* waits until the gpu is done with the region from NFRAMES ago */
+    u32 push(const void* pData, u32 size); /* offset relative to this frame's region */
+    void upload(); /* everything pushed since beginFrame, grows the buffer if needed */
+    void endFrame();
+    void bindRange(GLuint point, u32 offset, u32 size) const;
+    void bindBlock(Shader* sh, std::string_view block, GLuint point);
+};
+
+/* std140 layout of the ubDraw block */
+struct DrawData
+{
+    m4 tm;
+    v4 nm[3]; /* mat3 columns are padded to vec4 */
+    GLint bQuantized;
+    u8 pad[12];
+};
+
+static_assert(offsetof(DrawData, tm) == 0);
+static_assert(offsetof(DrawData, nm) == 64);
+static_assert(offsetof(DrawData, bQuantized) == 112);
+static_assert(sizeof(DrawData) % 16 == 0);
+
 struct Vertex
 {
     v3 pos;
@@ -73,6 +135,17 @@ struct Vertex
     v3 bitan;
 };
 
+/* 20 bytes, shaders decode normals and tangents when uQuantized is set */
+struct QuantizedVertex
+{
+    s16 pos[4]; /* snorm in mesh bounds, see Model::aTmDequant, w holds the bitangent sign */
+    u16 tex[2]; /* unorm, or half floats if the coords are outside of [0, 1] */
+    s16 norm[2]; /* octahedral snorm */
+    s16 tan[2]; /* octahedral snorm */
+};
+
+static_assert(sizeof(QuantizedVertex) == 20);
+
 struct Materials
 {
     Texture diffuse;
@@ -85,6 +158,10 @@ struct MeshData
     GLuint vbo;
     GLuint ebo;
     GLuint eboSize;
+    GLuint instVao; /* same attributes plus per instance matrix from the render queue, 0 if mesh isn't batched */
+    GLuint depthVao; /* heap pool position stream, 0 outside of the heap */
+    GLuint depthInstVao; /* same with per instance matrix, 0 if mesh isn't batched */
+    GpuRange range; /* in gpuHeap, vao and buffers belong to the heap pool then */
 
     Materials materials;
 
@@ -98,6 +175,48 @@ struct Mesh
     enum gltf::COMPONENT_TYPE indType;
     enum gltf::PRIMITIVES mode;
     size_t triangleCount;
+    AABB bounds {}; /* object space */
+    bool bQuantized = false;
+    bool bHalfTex = false; /* quantized with half float texture coords */
+    bool bAlphaTest = false; /* material discards fragments (gltf MASK or BLEND), kept out of depth only passes that can't discard */
+};
+
+/* per node EXT_mesh_gpu_instancing data */
+struct Instances
+{
+    GLuint vbo = 0; /* mat4 per instance */
+    GLsizei count = 0;
+    std::vector<GLuint> aVaos; /* one for each primitive of the node's mesh */
+    std::vector<GLuint> aDepthVaos; /* position stream only, empty if the mesh isn't in the heap */
+    AABB bounds {}; /* all instances in node space */
+};
+
+struct DrawStats
+{
+    u64 drawCalls;
+    u64 instances;
+    u64 drawCallsSaved; /* by automatic instancing of repeated meshes */
+    u64 triangles; /* submitted, each instance counts */
+    u64 visible; /* primitives that passed frustum culling */
+    u64 culled;
+};
+
+extern DrawStats drawStats; /* reset each frame */
+
+struct RenderQueue;
+struct RenderPass;
+
+/* one entry of Model's retained draw list */
+struct RetainedDraw
+{
+    AABB box; /* world space */
+    const Mesh* pMesh; /* null for batched nodes */
+    GLuint vao;
+    GLuint depthVao; /* for DRAW::DEPTH passes */
+    u32 slot; /* draw data index in Model::aDrawDataCache */
+    GLsizei nInstances;
+    s32 batch; /* mesh gathered into an instanced packet, -1 otherwise */
+    u32 tm; /* instance matrix of batched nodes in Model::aRetainedTms */
 };
 
 struct Model
@@ -105,29 +224,71 @@ struct Model
     std::string_view savedPath;
     /*std::vector<Mesh> aMeshes;*/
     std::vector<std::vector<Mesh>> aaMeshes;
+    std::vector<Instances> aInstances; /* indexed by node, count is 0 for not instanced nodes */
+    std::vector<AABB> aMeshBounds; /* union of primitive bounds, used to cull batched nodes */
+    std::vector<m4> aTmDequant; /* per mesh, maps quantized positions back to the mesh bounds, identity otherwise */
+    bool bQuantized = false;
     gltf::Asset asset;
 
     Model() = default;
     Model(const Model& other) = delete;
     Model(Model&& other);
-    Model(std::string_view path, GLint drawMode, GLint texMode, App* c);
+    Model(std::string_view path, GLint drawMode, GLint texMode, App* c, enum LOAD flags = LOAD::NONE);
     ~Model();
 
     Model& operator=(const Model& other) = delete;
     Model& operator=(Model&& other);
 
-    void load(std::string_view path, GLint drawMode, GLint texMode, App* c);
-    void loadOBJ(std::string_view path, GLint drawMode, GLint texMode, App* c);
-    void loadGLTF(std::string_view path, GLint drawMode, GLint texMode, App* c);
-    void draw(enum DRAW flags, Shader* sh = nullptr, std::string_view svUniform = "", std::string_view svUniformM3Norm = "", const m4& tmGlobal = {});
-    void drawGraph(enum DRAW flags, Shader* sh, std::string_view svUniform, std::string_view svUniformM3Norm, const m4& tmGlobal);
-    /*void drawInstanced(GLsizei count);*/
+    void load(std::string_view path, GLint drawMode, GLint texMode, App* c, enum LOAD flags = LOAD::NONE);
+    void loadOBJ(std::string_view path, GLint drawMode, GLint texMode, App* c, enum LOAD flags = LOAD::NONE); /* obj meshes always go to gpuHeap, drawMode is unused */
+    void loadGLTF(std::string_view path, GLint drawMode, GLint texMode, App* c, enum LOAD flags = LOAD::NONE);
+    void prepareDraw(UboRing* pRing, const m4& tmGlobal); /* every mesh with tmGlobal, uploads the draw list for queueDraw() this frame */
+    void prepareDrawGraph(UboRing* pRing, const m4& tmGlobal, ThreadPool* pTp = nullptr); /* same for the node graph, recompiles the list only if something moved */
+    void queueDraw(RenderQueue* pQueue, const RenderPass& pass);
+    void setNodeTransform(size_t node, const v3& translation, const qt& rotation, const v3& scale);
+    void updateTransforms(const m4& tmGlobal, ThreadPool* pTp = nullptr);
+    void invalidateDrawList() { this->bDrawListValid = false; } /* after changing meshes or materials directly */
 
 private:
-    void parseOBJ(std::string_view path, GLint drawMode, GLint texMode, App* c);
+    void destroy(); /* frees gl objects and heap ranges of every mesh */
+    void parseOBJ(std::string_view path, GLint texMode, App* c, enum LOAD flags);
+    void buildStaticBatches(App* c);
+    bool isStaticNode(u32 node) const { return !this->aStaticNodes.empty() && this->aStaticNodes[node]; }
+    void queueBatches(RenderQueue* pQueue, const RenderPass& pass);
+    void pushDrawList(UboRing* pRing);
+    void compileDrawList();
+
+    /* rebuilt only when transforms or meshes change, replayed by every queueDraw() */
+    std::vector<RetainedDraw> aRetained;
+    std::vector<m4> aRetainedTms;
+    std::vector<u8> aDrawDataCache; /* DrawData padded to drawStride, pushed to the ring as one block each frame */
+    u32 drawStride = 0;
+    bool bDrawListValid = false;
+    bool bDrawListGraph = false;
 
-    std::vector<int> aTmIdxs; /* parents map */
-    std::vector<int> aTmCounters; /* map's sizes */
+    const UboRing* pDrawRing = nullptr;
+    u32 drawBase = 0; /* aDrawDataCache offset in pDrawRing this frame */
+
+    std::vector<std::vector<m4>> aaBatchTms; /* world matrices of batched nodes gathered per mesh, kept between frames to avoid allocations */
+    std::vector<f32> aBatchDepths; /* closest node of each gathered mesh */
+
+    /* LOAD::STATIC_BATCH: vertices are pre-transformed into model space, only tmGlobal is applied when drawing */
+    std::vector<Mesh> aStaticBatches;
+    std::vector<m4> aStaticDequant; /* per batch, like aTmDequant */
+    std::vector<bool> aStaticNodes; /* nodes drawn as part of a batch */
+
+    void flattenGraph();
+
+    /* node graph in depth first order, subtree of the node at pos is [pos, aGraphSubtreeEnds[pos]) */
+    std::vector<u32> aGraphOrder; /* pos -> node */
+    std::vector<u32> aGraphPos; /* node -> pos */
+    std::vector<u32> aGraphSubtreeEnds;
+    std::vector<u32> aMeshNodes;
+    std::vector<u32> aDirtyNodes;
+    TransformBatch transforms; /* indexed by pos, world matrices are cached until the node or one of its parents changes */
+    std::vector<m3> aNormalTms; /* per node with mesh */
+    m4 tmLastGlobal {}; /* of the last prepareDraw or prepareDrawGraph */
+    bool bGraphValid = false;
 };
 
 inline u64
@@ -153,9 +314,17 @@ namespace std
     };
 }
 
-Model getQuad(GLint drawMode = GL_STATIC_DRAW);
-Model getPlane(GLint drawMode = GL_STATIC_DRAW);
-Model getCube(GLint drawMode = GL_STATIC_DRAW);
+/* uniform buffer binding points */
+constexpr GLuint PROJ_VIEW_UBO_POINT = 0;
+constexpr GLuint DRAW_UBO_POINT = 1;
+constexpr GLuint POINT_LIGHTS_UBO_POINT = 2;
+constexpr GLuint SHADOW_ATLAS_UBO_POINT = 3;
+
+void setInstanceAttribDefaults();
+void drawMesh(const Mesh& e, GLsizei nInstances);
+Model getQuad();
+Model getPlane();
+Model getCube();
 void drawQuad(const Model& q);
 void drawPlane(const Model& q);
 void drawCube(const Model& q);
@@ -4,6 +4,7 @@
 #include "utils.hh"
 #include "wayland.hh"
 
+#include <algorithm>
 #include <cstring>
 
 EGLint eglLastErrorCode = EGL_SUCCESS;
@@ -160,6 +161,61 @@ static const xdg_toplevel_listener xdgToplevelListener {
     .wm_capabilities = xdgToplevelWmCapabilities
 };
 
+static void
+outputGeometryHandler([[maybe_unused]] void* data,
+                      [[maybe_unused]] wl_output* output,
+                      [[maybe_unused]] s32 x,
+                      [[maybe_unused]] s32 y,
+                      [[maybe_unused]] s32 physicalWidth,
+                      [[maybe_unused]] s32 physicalHeight,
+                      [[maybe_unused]] s32 subpixel,
+                      [[maybe_unused]] const char* make,
+                      [[maybe_unused]] const char* model,
+                      [[maybe_unused]] s32 transform)
+{
+    //
+}
+
+static void
+outputModeHandler([[maybe_unused]] void* data,
+                  [[maybe_unused]] wl_output* output,
+                  [[maybe_unused]] u32 flags,
+                  [[maybe_unused]] s32 width,
+                  [[maybe_unused]] s32 height,
+                  [[maybe_unused]] s32 refresh)
+{
+    auto app = (WlClient*)data;
+
+    /* refresh is in mHz, 0 if the compositor doesn't know */
+    if ((flags & WL_OUTPUT_MODE_CURRENT) && refresh > 0)
+    {
+        app->refreshRate = refresh / 1000.0;
+        LOG(OK, "output mode: {}x{}, refresh rate: {:.3f}\n", width, height, app->refreshRate);
+    }
+}
+
+static void
+outputDoneHandler([[maybe_unused]] void* data,
+                  [[maybe_unused]] wl_output* output)
+{
+    //
+}
+
+static void
+outputScaleHandler([[maybe_unused]] void* data,
+                   [[maybe_unused]] wl_output* output,
+                   [[maybe_unused]] s32 factor)
+{
+    //
+}
+
+static const wl_output_listener outputListener {
+    .geometry = outputGeometryHandler,
+    .mode = outputModeHandler,
+    .done = outputDoneHandler,
+    .scale = outputScaleHandler
+};
+
 static void
 registryGlobalHandler([[maybe_unused]] void* data,
                       [[maybe_unused]] wl_registry* registry,
@@ -198,7 +254,9 @@ registryGlobalHandler([[maybe_unused]] void* data,
     }
     else if (strcmp(interface, wl_output_interface.name) == 0)
     {
-        app->output = (wl_output*)wl_registry_bind(registry, name, &wl_output_interface, version);
+        /* the listener has the events up to version 2, name and description come with version 4 */
+        app->output = (wl_output*)wl_registry_bind(registry, name, &wl_output_interface, std::min(version, 2u));
+        wl_output_add_listener(app->output, &outputListener, app);
     }
 }
 
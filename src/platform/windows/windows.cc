@@ -103,7 +103,7 @@ GetWglFunctions(void)
 
 Win32window::Win32window(std::string_view name, HINSTANCE _instance)
 {
-    this->name = name;
+    this->svName = name;
     this->instance = _instance;
     init();
 }
@@ -160,6 +160,11 @@ Win32window::init()
     if (!deviceContext)
         LOG(FATAL, "GetDC failed\n");
 
+    /* 0 and 1 mean the hardware default */
+    int refresh = GetDeviceCaps(deviceContext, VREFRESH);
+    if (refresh > 1)
+        this->refreshRate = refresh;
+
     int attrib[] {
         WGL_DRAW_TO_WINDOW_ARB, GL_TRUE,
         WGL_SUPPORT_OPENGL_ARB, GL_TRUE,
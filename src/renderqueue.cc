@@ -0,0 +1,180 @@
+#include "renderqueue.hh"
+
+#include <algorithm>
+
+/* key fields from the most significant bits, gl names are truncated, collisions only cost extra state changes */
+constexpr u32 PASS_BITS = 8;
+constexpr u32 PROGRAM_BITS = 8;
+constexpr u32 MATERIAL_BITS = 16;
+constexpr u32 VAO_BITS = 16;
+constexpr u32 DEPTH_BITS = 16;
+
+static_assert(PASS_BITS + PROGRAM_BITS + MATERIAL_BITS + VAO_BITS + DEPTH_BITS == 64);
+
+constexpr u32 PASS_SHIFT = 64 - PASS_BITS;
+constexpr u32 PROGRAM_SHIFT = PASS_SHIFT - PROGRAM_BITS;
+
+static inline u64
+keyField(u64 value, u32 bits)
+{
+    return value & ((1ull << bits) - 1);
+}
+
+static GLuint
+materialId(const DrawPacket& p)
+{
+    auto& mat = p.pMesh->meshData.materials;
+    GLuint id = 0;
+    if (p.flags & DRAW::DIFF)
+        id = mat.diffuse.id;
+    if (p.flags & DRAW::NORM)
+        id ^= mat.normal.id << 8;
+
+    return id;
+}
+
+static u64
+makeKey(const RenderPass& pass, const DrawPacket& p, f32 depth)
+{
+    f32 d = std::clamp(depth / pass.farPlane, 0.0f, 1.0f);
+    u64 depthBits = static_cast<u64>(d * ((1u << DEPTH_BITS) - 1));
+    u64 material = keyField(materialId(p), MATERIAL_BITS);
+    u64 vao = keyField(p.vao, VAO_BITS);
+
+    u64 key = keyField(pass.id, PASS_BITS) << PASS_SHIFT;
+    key |= keyField(p.program, PROGRAM_BITS) << PROGRAM_SHIFT;
+
+    if (pass.sort == SORT::FRONT_TO_BACK)
+        key |= depthBits << (MATERIAL_BITS + VAO_BITS) | material << VAO_BITS | vao;
+    else
+        key |= material << (VAO_BITS + DEPTH_BITS) | vao << DEPTH_BITS | depthBits;
+
+    return key;
+}
+
+RenderQueue::~RenderQueue()
+{
+    if (this->instVbo)
+        glDeleteBuffers(1, &this->instVbo);
+}
+
+void
+RenderQueue::clear()
+{
+    this->aPackets.clear();
+    this->aEntries.clear();
+    this->aInstanceTms.clear();
+    this->stats = {};
+}
+
+void
+RenderQueue::push(const RenderPass& pass, const DrawPacket& packet, f32 depth)
+{
+    this->aEntries.push_back({makeKey(pass, packet, depth), static_cast<u32>(this->aPackets.size())});
+    this->aPackets.push_back(packet);
+}
+
+u32
+RenderQueue::pushInstances(const m4* pTms, u32 count)
+{
+    u32 first = this->aInstanceTms.size();
+    this->aInstanceTms.insert(this->aInstanceTms.end(), pTms, pTms + count);
+
+    return first;
+}
+
+/* lsd radix sort by bytes, stable so equal keys keep the order they were pushed in */
+void
+RenderQueue::sortEntries()
+{
+    size_t n = this->aEntries.size();
+    if (n < 2)
+        return;
+
+    this->aTmp.resize(n);
+
+    for (u32 shift = 0; shift < 64; shift += 8)
+    {
+        u32 aCounts[256] {};
+        for (auto& e : this->aEntries)
+            aCounts[(e.key >> shift) & 0xff]++;
+
+        /* every key has the same byte here */
+        if (aCounts[(this->aEntries[0].key >> shift) & 0xff] == n)
+            continue;
+
+        u32 sum = 0;
+        for (auto& c : aCounts)
+        {
+            u32 count = c;
+            c = sum;
+            sum += count;
+        }
+
+        for (auto& e : this->aEntries)
+            this->aTmp[aCounts[(e.key >> shift) & 0xff]++] = e;
+
+        std::swap(this->aEntries, this->aTmp);
+    }
+}
+
+void
+RenderQueue::prepare()
+{
+    this->sortEntries();
+
+    if (this->aInstanceTms.empty())
+        return;
+
+    if (!this->instVbo)
+        glGenBuffers(1, &this->instVbo);
+
+    /* orphan and refill, previous contents may still be in use by the gpu */
+    glBindBuffer(GL_ARRAY_BUFFER, this->instVbo);
+    glBufferData(GL_ARRAY_BUFFER, this->aInstanceTms.size() * sizeof(m4), this->aInstanceTms.data(), GL_STREAM_DRAW);
+}
+
+void
+RenderQueue::submit(u32 pass)
+{
+    u64 passKey = keyField(pass, PASS_BITS) << PASS_SHIFT;
+    auto it = std::lower_bound(this->aEntries.begin(), this->aEntries.end(), passKey,
+                               [](const Entry& e, u64 key) { return e.key < key; });
+
+    if (!this->aInstanceTms.empty())
+        glBindBuffer(GL_ARRAY_BUFFER, this->instVbo);
+
+    const DrawPacket* pLast = nullptr;
+    for (; it != this->aEntries.end() && (it->key >> PASS_SHIFT) == pass; ++it)
+    {
+        const DrawPacket& p = this->aPackets[it->packet];
+        auto& mat = p.pMesh->meshData.materials;
+
+        this->stats.packets++;
+        if (!pLast || pLast->program != p.program) this->stats.programChanges++;
+        if (!pLast || pLast->vao != p.vao) this->stats.vaoChanges++;
+        if ((p.flags & (DRAW::DIFF | DRAW::NORM)) && (!pLast || materialId(*pLast) != materialId(p))) this->stats.textureChanges++;
+        pLast = &p;
+
+        gl::useProgram(p.program);
+        gl::bindVertexArray(p.vao);
+
+        /* point instance attributes at this packet's range */
+        if (p.instFirst >= 0)
+        {
+            for (GLuint c = 0; c < 4; c++)
+                glVertexAttribPointer(INSTANCE_ATTRIB_LOC + c, 4, GL_FLOAT, GL_FALSE, sizeof(m4),
+                                      reinterpret_cast<void*>(p.instFirst*sizeof(m4) + sizeof(v4)*c));
+            drawStats.drawCallsSaved += p.nInstances - 1;
+        }
+
+        if (p.flags & DRAW::DIFF)
+            mat.diffuse.bind(GL_TEXTURE0);
+        if (p.flags & DRAW::NORM)
+            mat.normal.bind(GL_TEXTURE1);
+        if (p.flags & DRAW::APPLY_TM)
+            p.pRing->bindRange(DRAW_UBO_POINT, p.drawOffset, sizeof(DrawData));
+
+        drawMesh(*p.pMesh, p.nInstances);
+    }
+}
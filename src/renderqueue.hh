@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+
+#include "model.hh"
+
+enum class SORT : u8
+{
+    STATE,         /* pass, program, material, vertex array, depth: fewest state changes */
+    FRONT_TO_BACK, /* pass, program, depth, material, vertex array: opaque geometry for early depth rejection */
+};
+
+/* what models queue their draws for, passes are submitted one by one in frame order */
+struct RenderPass
+{
+    u32 id; /* < 256, sorts packets of one pass together */
+    const Shader* pShader;
+    enum DRAW flags;
+    const Frustum* pFrustum; /* nullptr to draw everything */
+    v3 eye; /* depth of a packet is the distance of its bounds from eye */
+    f32 farPlane;
+    enum SORT sort;
+    f32 cullRange = 0.0f; /* if set, bounds farther than this from eye are culled too */
+};
+
+/* everything needed to issue one draw call */
+struct DrawPacket
+{
+    const Mesh* pMesh;
+    const UboRing* pRing;
+    GLuint program;
+    GLuint vao;
+    u32 drawOffset; /* in pRing, used with DRAW::APPLY_TM */
+    GLsizei nInstances;
+    s32 instFirst; /* into the queue's instance matrices, -1 if the vertex array has its own */
+    enum DRAW flags;
+};
+
+/* state changes between consecutive submitted packets, reset on clear() */
+struct QueueStats
+{
+    u64 packets;
+    u64 programChanges;
+    u64 textureChanges;
+    u64 vaoChanges;
+};
+
+struct RenderQueue
+{
+    QueueStats stats {};
+
+    RenderQueue() = default;
+    RenderQueue(const RenderQueue& other) = delete;
+    ~RenderQueue();
+
+    RenderQueue& operator=(const RenderQueue& other) = delete;
+
+    void clear();
+    void push(const RenderPass& pass, const DrawPacket& packet, f32 depth);
+    u32 pushInstances(const m4* pTms, u32 count); /* first index for DrawPacket::instFirst */
+    void prepare(); /* radix sorts everything pushed since clear() and uploads instance matrices */
+    void submit(u32 pass);
+
+private:
+    struct Entry
+    {
+        u64 key;
+        u32 packet;
+    };
+
+    std::vector<DrawPacket> aPackets;
+    std::vector<Entry> aEntries;
+    std::vector<Entry> aTmp;
+    std::vector<m4> aInstanceTms;
+    GLuint instVbo = 0;
+
+    void sortEntries();
+};
@@ -1,5 +1,7 @@
 #include "shader.hh"
-#include "utils.hh"
+
+#include <algorithm>
+#include <cstring>
 
 Shader::Shader(std::string_view vertexPath, std::string_view fragmentPath)
 {
@@ -13,10 +15,16 @@ Shader::Shader(std::string_view vertexPath, std::string_view geometryPath, std::
 
 void
 Shader::loadShaders(std::string_view vertexPath, std::string_view fragmentPath)
+{
+    this->loadShaders(vertexPath, fragmentPath, {});
+}
+
+void
+Shader::loadShaders(std::string_view vertexPath, std::string_view fragmentPath, std::initializer_list<std::string_view> aDefines)
 {
     GLint linked;
-    GLuint vertex = this->loadShader(GL_VERTEX_SHADER, vertexPath);
-    GLuint fragment = this->loadShader(GL_FRAGMENT_SHADER, fragmentPath);
+    GLuint vertex = this->loadShader(GL_VERTEX_SHADER, vertexPath, aDefines);
+    GLuint fragment = this->loadShader(GL_FRAGMENT_SHADER, fragmentPath, aDefines);
 
     this->id = glCreateProgram();
     if (this->id == 0)
@@ -45,6 +53,8 @@ Shader::loadShaders(std::string_view vertexPath, std::string_view fragmentPath)
     glValidateProgram(this->id);
 #endif
 
+    this->queryActiveUniforms();
+
     glDeleteShader(vertex);
     glDeleteShader(fragment);
 }
@@ -85,6 +95,8 @@ Shader::loadShaders(std::string_view vertexPath, std::string_view geometryPath,
     glValidateProgram(this->id);
 #endif
 
+    this->queryActiveUniforms();
+
     glDeleteShader(vertex);
     glDeleteShader(fragment);
     glDeleteShader(geometry);
@@ -99,6 +111,8 @@ void
 Shader::operator=(Shader&& other)
 {
     this->id = other.id;
+    this->aUniforms = std::move(other.aUniforms);
+    this->aValues = std::move(other.aValues);
     other.id = 0;
 }
 
@@ -112,14 +126,27 @@ Shader::~Shader()
 }
 
 GLuint
-Shader::loadShader(GLenum type, std::string_view path)
+Shader::loadShader(GLenum type, std::string_view path, std::initializer_list<std::string_view> aDefines)
 {
     GLuint shader;
     shader = glCreateShader(type);
     if (!shader)
         return 0;
 
-    const auto src = loadFileToCharArray(path);
+    auto src = loadFileToCharArray(path);
+
+    /* #version has to stay the first line */
+    if (aDefines.size() > 0)
+    {
+        std::string defines;
+        for (auto d : aDefines)
+            defines += FMT("#define {}\n", d);
+
+        auto it = std::find(src.begin(), src.end(), '\n');
+        if (it != src.end()) it++;
+        src.insert(it, defines.begin(), defines.end());
+    }
+
     const char* srcData = src.data();
 
     glShaderSource(shader, 1, &srcData, nullptr);
@@ -148,9 +175,43 @@ Shader::loadShader(GLenum type, std::string_view path)
 void
 Shader::use() const
 {
-    glUseProgram(this->id);
+    gl::useProgram(this->id);
 }
 
+static u32
+uniformTypeSize(GLenum type)
+{
+    switch (type)
+    {
+        case GL_FLOAT_VEC2:
+        case GL_INT_VEC2:
+        case GL_BOOL_VEC2:
+            return sizeof(f32) * 2;
+
+        case GL_FLOAT_VEC3:
+        case GL_INT_VEC3:
+        case GL_BOOL_VEC3:
+            return sizeof(f32) * 3;
+
+        case GL_FLOAT_VEC4:
+        case GL_INT_VEC4:
+        case GL_BOOL_VEC4:
+        case GL_FLOAT_MAT2:
+            return sizeof(f32) * 4;
+
+        case GL_FLOAT_MAT3:
+            return sizeof(m3::e);
+
+        case GL_FLOAT_MAT4:
+            return sizeof(m4);
+
+        /* floats, ints, bools and samplers */
+        default:
+            return sizeof(f32);
+    }
+}
+
+/* fills the uniform cache, locations are only queried here */
 void
 Shader::queryActiveUniforms()
 {
@@ -161,15 +222,42 @@ Shader::queryActiveUniforms()
     glGetProgramiv(this->id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxUniformLen);
 
     std::vector<char> uniformName(maxUniformLen, '\0');
+#ifdef DEBUG
     LOG(OK, "queryActiveUniforms for '{}':\n", this->id);
+#endif
+
+    this->aUniforms.clear();
+    this->aValues.clear();
 
     for (int i = 0; i < nUniforms; i++)
     {
         GLint size;
         GLenum type;
-        std::string_view typeName;
 
         glGetActiveUniform(this->id, i, maxUniformLen, nullptr, &size, &type, uniformName.data());
+
+        /* uniform block members have no location */
+        GLint loc = glGetUniformLocation(this->id, uniformName.data());
+        if (loc < 0)
+            continue;
+
+        /* arrays are reported as "name[0]" */
+        std::string_view svName = uniformName.data();
+        if (svName.ends_with("[0]"))
+            svName.remove_suffix(3);
+
+        u32 valueSize = uniformTypeSize(type) * size;
+        this->aUniforms.push_back({
+            .hash = hashFNV(svName),
+            .loc = loc,
+            .valueOff = static_cast<u32>(this->aValues.size()),
+            .valueSize = valueSize,
+            .bSet = false
+        });
+        this->aValues.resize(this->aValues.size() + valueSize);
+
+#ifdef DEBUG
+        std::string_view typeName;
         switch (type)
         {
             case GL_FLOAT:
@@ -204,47 +292,85 @@ Shader::queryActiveUniforms()
                 typeName = "unknown";
                 break;
         }
-        LOG(OK, "\tuniformName: '{}', type: '{}'\n", uniformName.data(), typeName);
+        LOG(OK, "\tuniformName: '{}', type: '{}', size: {}, loc: {}\n", svName, typeName, size, loc);
+#endif
     }
 }
 
+/* -1 if the uniform is not active or already holds the value */
+GLint
+Shader::changedUniformLoc(const UniformName& name, const void* pData, size_t size)
+{
+    for (auto& u : this->aUniforms)
+    {
+        if (u.hash != name.hash)
+            continue;
+
+        size = std::min(size, static_cast<size_t>(u.valueSize));
+        u8* pCached = &this->aValues[u.valueOff];
+        if (u.bSet && memcmp(pCached, pData, size) == 0)
+            return -1;
+
+        memcpy(pCached, pData, size);
+        u.bSet = true;
+        return u.loc;
+    }
+
+    return -1;
+}
+
 void 
-Shader::setM4(std::string_view name, const m4& m)
+Shader::setM4(const UniformName& name, const m4& m)
+{
+    GLint ul = this->changedUniformLoc(name, m.e, sizeof(m.e));
+    if (ul >= 0)
+        glUniformMatrix4fv(ul, 1, GL_FALSE, (GLfloat*)m.e);
+}
+
+void
+Shader::setM4(const UniformName& name, const m4* pM, GLsizei count)
 {
-    GLint ul;
-    ul = glGetUniformLocation(this->id, name.data());
-    glUniformMatrix4fv(ul, 1, GL_FALSE, (GLfloat*)m.e);
+    GLint ul = this->changedUniformLoc(name, pM, sizeof(m4) * count);
+    if (ul >= 0)
+        glUniformMatrix4fv(ul, count, GL_FALSE, (GLfloat*)pM);
 }
 
 void 
-Shader::setM3(std::string_view name, const m3& m)
+Shader::setM3(const UniformName& name, const m3& m)
 {
-    GLint ul;
-    ul = glGetUniformLocation(this->id, name.data());
-    glUniformMatrix3fv(ul, 1, GL_FALSE, (GLfloat*)m.e);
+    GLint ul = this->changedUniformLoc(name, m.e, sizeof(m.e));
+    if (ul >= 0)
+        glUniformMatrix3fv(ul, 1, GL_FALSE, (GLfloat*)m.e);
 }
 
+void
+Shader::setV2(const UniformName& name, const v2& v)
+{
+    GLint ul = this->changedUniformLoc(name, v.e, sizeof(v.e));
+    if (ul >= 0)
+        glUniform2fv(ul, 1, (GLfloat*)v.e);
+}
 
 void
-Shader::setV3(std::string_view name, const v3& v)
+Shader::setV3(const UniformName& name, const v3& v)
 {
-    GLint ul;
-    ul = glGetUniformLocation(this->id, name.data());
-    glUniform3fv(ul, 1, (GLfloat*)v.e);
+    GLint ul = this->changedUniformLoc(name, v.e, sizeof(v.e));
+    if (ul >= 0)
+        glUniform3fv(ul, 1, (GLfloat*)v.e);
 }
 
 void
-Shader::setI(std::string_view name, const GLint i)
+Shader::setI(const UniformName& name, const GLint i)
 {
-    GLint ul;
-    ul = glGetUniformLocation(this->id, name.data());
-    glUniform1i(ul, i);
+    GLint ul = this->changedUniformLoc(name, &i, sizeof(i));
+    if (ul >= 0)
+        glUniform1i(ul, i);
 }
 
 void
-Shader::setF(std::string_view name, const f32 f)
+Shader::setF(const UniformName& name, const f32 f)
 {
-    GLint ul;
-    ul = glGetUniformLocation(this->id, name.data());
-    glUniform1f(ul, f);
+    GLint ul = this->changedUniformLoc(name, &f, sizeof(f));
+    if (ul >= 0)
+        glUniform1f(ul, f);
 }
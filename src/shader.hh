@@ -1,8 +1,21 @@
 #pragma once
 #include "gmath.hh"
 #include "gl/gl.hh"
+#include "utils.hh"
 
+#include <initializer_list>
 #include <string_view>
+#include <vector>
+
+/* uniforms are looked up by name hash, keep the name around so string literals get hashed only once */
+struct UniformName
+{
+    std::string_view sv;
+    u64 hash;
+
+    constexpr UniformName(const char* s) : sv(s), hash(hashFNV(sv)) {}
+    constexpr UniformName(std::string_view s) : sv(s), hash(hashFNV(s)) {}
+};
 
 struct Shader
 {
@@ -18,15 +31,32 @@ struct Shader
     void operator=(Shader&& other);
 
     void loadShaders(std::string_view vertShaderPath, std::string_view fragShaderPath);
+    void loadShaders(std::string_view vertShaderPath, std::string_view fragShaderPath, std::initializer_list<std::string_view> aDefines); /* #define NAME for each, inserted after #version */
     void loadShaders(std::string_view vertexPath, std::string_view geometryPath, std::string_view fragmentPath);
     void use() const;
-    void setM3(std::string_view name, const m3& m);
-    void setM4(std::string_view name, const m4& m);
-    void setV3(std::string_view name, const v3& v);
-    void setI(std::string_view name, const GLint i);
-    void setF(std::string_view name, const f32 f);
+    void setM3(const UniformName& name, const m3& m);
+    void setM4(const UniformName& name, const m4& m);
+    void setM4(const UniformName& name, const m4* pM, GLsizei count); /* array uniforms are named without [] */
+    void setV2(const UniformName& name, const v2& v);
+    void setV3(const UniformName& name, const v3& v);
+    void setI(const UniformName& name, const GLint i);
+    void setF(const UniformName& name, const f32 f);
     void queryActiveUniforms();
 
 private:
-    GLuint loadShader(GLenum type, std::string_view path);
+    /* resolved once after linking, with the last uploaded value to skip redundant uploads */
+    struct Uniform
+    {
+        u64 hash;
+        GLint loc;
+        u32 valueOff; /* into aValues */
+        u32 valueSize; /* whole array for array uniforms */
+        bool bSet;
+    };
+
+    std::vector<Uniform> aUniforms;
+    std::vector<u8> aValues;
+
+    GLuint loadShader(GLenum type, std::string_view path, std::initializer_list<std::string_view> aDefines = {});
+    GLint changedUniformLoc(const UniformName& name, const void* pData, size_t size);
 };
@@ -0,0 +1,261 @@
+#include "shadowatlas.hh"
+
+#include <algorithm>
+
+#include "utils.hh"
+
+ShadowAtlas::~ShadowAtlas()
+{
+    if (this->fbo)
+        glDeleteFramebuffers(1, &this->fbo);
+    if (this->tex)
+        glDeleteTextures(1, &this->tex);
+}
+
+void
+ShadowAtlas::create()
+{
+    glGenTextures(1, &this->tex);
+    glBindTexture(GL_TEXTURE_2D, this->tex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT16, SIZE, SIZE);
+    /* depth formats aren't filterable without compare mode */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLenum none = GL_NONE;
+    glGenFramebuffers(1, &this->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->tex, 0);
+    glDrawBuffers(1, &none);
+    glReadBuffer(GL_NONE);
+
+    if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER))
+        LOG(FATAL, "glCheckFramebufferStatus != GL_FRAMEBUFFER_COMPLETE\n");
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void
+ShadowAtlas::fillCells(const Slot& s, bool bUsed)
+{
+    u32 w = 3u << s.tier, h = 2u << s.tier;
+    for (u32 y = s.cellY; y < s.cellY + h; y++)
+        for (u32 x = s.cellX; x < s.cellX + w; x++)
+            this->aCells[y * CELLS + x] = bUsed;
+}
+
+/* first fit over the cell grid */
+bool
+ShadowAtlas::alloc(u32 slot, u32 tier)
+{
+    u32 w = 3u << tier, h = 2u << tier;
+
+    for (u32 y = 0; y + h <= CELLS; y++)
+    {
+        for (u32 x = 0; x + w <= CELLS; x++)
+        {
+            bool bFree = true;
+            for (u32 cy = y; cy < y + h && bFree; cy++)
+                for (u32 cx = x; cx < x + w && bFree; cx++)
+                    bFree = !this->aCells[cy * CELLS + cx];
+
+            if (!bFree)
+                continue;
+
+            auto& s = this->aSlots[slot];
+            s.tier = tier;
+            s.cellX = x;
+            s.cellY = y;
+            s.bValid = false;
+            this->fillCells(s, true);
+
+            f32 texel = 1.0f / SIZE;
+            this->aShadows[slot].rect = v4(x * CELL * texel, y * CELL * texel, (CELL << tier) * texel, 0.0f);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+ShadowAtlas::free(u32 slot)
+{
+    auto& s = this->aSlots[slot];
+    this->fillCells(s, false);
+    s.light = -1;
+    s.bValid = false;
+}
+
+/* screen coverage where each face size starts */
+constexpr f32 TIER_COVERAGE[ShadowAtlas::NTIERS] {0.0f, 0.2f, 0.5f};
+
+static inline u32
+tierForCoverage(f32 coverage)
+{
+    u32 t = 0;
+    while (t + 1 < ShadowAtlas::NTIERS && coverage >= TIER_COVERAGE[t + 1])
+        t++;
+
+    return t;
+}
+
+/* with some slack, so lights near a threshold don't get a new block every frame */
+static inline bool
+keepsTier(u32 tier, f32 coverage)
+{
+    return coverage >= TIER_COVERAGE[tier] * 0.8f &&
+           (tier + 1 == ShadowAtlas::NTIERS || coverage < TIER_COVERAGE[tier + 1] * 1.25f);
+}
+
+u32
+ShadowAtlas::schedule(PointLight* pLights, u32 nLights, const Frustum& view, const v3& eye, f32 fov, u32* pUpdates, u32 maxUpdates)
+{
+    this->frame++;
+    f32 tanHalf = std::tan(fov / 2);
+
+    /* rank visible lights by the part of the screen height their range covers */
+    auto& aCandidates = this->aCandidates;
+    aCandidates.clear();
+    for (u32 i = 0; i < nLights; i++)
+    {
+        auto& l = pLights[i];
+        l.shadow = 0.0f;
+
+        v3 r {l.radius, l.radius, l.radius};
+        if (!frustumTestAABB(view, {l.pos - r, l.pos + r}))
+            continue;
+
+        f32 dist = std::max(v3Length(l.pos - eye), l.radius);
+        f32 coverage = std::min(l.radius / (dist * tanHalf), 1.0f);
+        if (coverage >= MIN_COVERAGE)
+            aCandidates.push_back({i, coverage});
+    }
+
+    u32 nRanked = std::min<u32>(aCandidates.size(), MAX_LIGHTS);
+    std::partial_sort(aCandidates.begin(), aCandidates.begin() + nRanked, aCandidates.end(),
+                      [](const Candidate& l, const Candidate& r) { return l.coverage > r.coverage; });
+
+    this->aLightSlots.assign(nLights, -1);
+    for (u32 i = 0; i < MAX_LIGHTS; i++)
+        if (this->aSlots[i].light >= 0 && static_cast<u32>(this->aSlots[i].light) < nLights)
+            this->aLightSlots[this->aSlots[i].light] = i;
+
+    /* free blocks of lights that dropped out or need smaller faces, before allocating new ones */
+    auto& aRanked = this->aRanked;
+    aRanked.assign(nLights, false);
+    for (u32 i = 0; i < nRanked; i++)
+    {
+        auto& c = aCandidates[i];
+        aRanked[c.light] = true;
+
+        s32 slot = this->aLightSlots[c.light];
+        if (slot >= 0 && !keepsTier(this->aSlots[slot].tier, c.coverage) && tierForCoverage(c.coverage) < this->aSlots[slot].tier)
+        {
+            this->free(slot);
+            this->aLightSlots[c.light] = -1;
+        }
+    }
+    for (u32 i = 0; i < MAX_LIGHTS; i++)
+    {
+        s32 light = this->aSlots[i].light;
+        if (light >= 0 && (static_cast<u32>(light) >= nLights || !aRanked[light]))
+            this->free(i);
+    }
+
+    auto freeSlot = [this] {
+        auto it = std::find_if(std::begin(this->aSlots), std::end(this->aSlots), [](const Slot& s) { return s.light < 0; });
+        return static_cast<u32>(it - std::begin(this->aSlots));
+    };
+
+    /* biggest lights first, fall back to smaller faces when the atlas is full */
+    for (u32 i = 0; i < nRanked; i++)
+    {
+        auto& c = aCandidates[i];
+        u32 tier = tierForCoverage(c.coverage);
+        s32 slot = this->aLightSlots[c.light];
+
+        if (slot < 0)
+        {
+            slot = freeSlot();
+            if (static_cast<u32>(slot) >= MAX_LIGHTS)
+                continue;
+
+            bool bAllocated = false;
+            for (s32 t = tier; t >= 0 && !bAllocated; t--)
+                bAllocated = this->alloc(slot, t);
+            if (!bAllocated)
+                continue;
+
+            this->aSlots[slot].light = c.light;
+            this->aLightSlots[c.light] = slot;
+        }
+        else if (!keepsTier(this->aSlots[slot].tier, c.coverage) && tier > this->aSlots[slot].tier)
+        {
+            /* grow only if the bigger block fits next to the current one, otherwise keep what is rendered */
+            u32 bigger = freeSlot();
+            if (bigger < MAX_LIGHTS && this->alloc(bigger, tier))
+            {
+                this->free(slot);
+                slot = bigger;
+                this->aSlots[slot].light = c.light;
+                this->aLightSlots[c.light] = slot;
+            }
+        }
+
+        this->aSlots[slot].coverage = c.coverage;
+    }
+
+    /* never rendered blocks first, then the most overdue ones, bigger faces are due more often */
+    auto period = [](const Slot& s) { return 1u << (NTIERS - 1 - s.tier); };
+    auto urgency = [&](const Slot& s) {
+        return s.bValid ? static_cast<f32>(this->frame - s.lastFrame) / period(s) * s.coverage : 1e30f;
+    };
+
+    u32 aOrder[MAX_LIGHTS];
+    u32 nUsed = 0;
+    for (u32 i = 0; i < MAX_LIGHTS; i++)
+        if (this->aSlots[i].light >= 0)
+            aOrder[nUsed++] = i;
+    std::sort(aOrder, aOrder + nUsed, [&](u32 l, u32 r) { return urgency(this->aSlots[l]) > urgency(this->aSlots[r]); });
+
+    u32 nUpdates = 0;
+    this->nUsedTexels = 0;
+    for (u32 i = 0; i < nUsed && nUpdates < maxUpdates; i++)
+    {
+        u32 slot = aOrder[i];
+        auto& s = this->aSlots[slot];
+        if (s.bValid && this->frame - s.lastFrame < period(s))
+            continue;
+
+        u32 cost = 6 * sq(this->faceSize(slot));
+        if (this->nUsedTexels + cost > this->budget)
+            continue;
+
+        this->nUsedTexels += cost;
+        pUpdates[nUpdates++] = slot;
+
+        auto& l = pLights[s.light];
+        s.lastFrame = this->frame;
+        s.bValid = true;
+        this->aShadows[slot].pos = l.pos;
+        this->aShadows[slot].farPlane = l.radius;
+    }
+
+    for (u32 i = 0; i < MAX_LIGHTS; i++)
+        if (this->aSlots[i].light >= 0 && this->aSlots[i].bValid)
+            pLights[this->aSlots[i].light].shadow = i + 1;
+
+    return nUpdates;
+}
+
+void
+ShadowAtlas::faceViewport(u32 slot, u32 face, GLint* pX, GLint* pY) const
+{
+    auto& s = this->aSlots[slot];
+    *pX = s.cellX * CELL + (face % 3) * this->faceSize(slot);
+    *pY = s.cellY * CELL + (face / 3) * this->faceSize(slot);
+}
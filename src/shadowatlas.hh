@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+
+#include "clusters.hh"
+
+/* std140 element of the ubShadowAtlas block */
+struct AtlasShadow
+{
+    v4 rect; /* xy: first face origin, z: face size, in atlas uv */
+    v3 pos; /* where the light was when its faces were rendered */
+    f32 farPlane;
+};
+
+static_assert(sizeof(AtlasShadow) == 32);
+
+/* one depth texture holding point light cube shadows as 3x2 blocks of faces, face i at (i % 3, i / 3).
+ * schedule() decides every frame which lights have a block, at what face size and which blocks get re-rendered:
+ * lights are ranked by how much of the screen their range covers, bigger lights get bigger faces and are
+ * refreshed more often, and re-rendering stops once the frame's texel budget is used up */
+struct ShadowAtlas
+{
+    static constexpr u32 SIZE = 2048;
+    static constexpr u32 CELL = 128; /* smallest face */
+    static constexpr u32 CELLS = SIZE / CELL;
+    static constexpr u32 NTIERS = 3; /* face sizes CELL << tier */
+    static constexpr u32 MAX_LIGHTS = 32; /* ubShadowAtlas array size */
+    static constexpr f32 MIN_COVERAGE = 0.05f; /* of the screen height, smaller lights go without shadows */
+
+    /* block of one light */
+    struct Slot
+    {
+        s32 light = -1; /* -1 if free */
+        u32 tier;
+        u32 cellX, cellY;
+        f32 coverage; /* last schedule() */
+        u32 lastFrame; /* of the last render */
+        bool bValid; /* rendered at least once */
+    };
+
+    GLuint tex = 0; /* GL_DEPTH_COMPONENT16, distance to the light / farPlane like cube shadows */
+    GLuint fbo = 0;
+    Slot aSlots[MAX_LIGHTS] {};
+    AtlasShadow aShadows[MAX_LIGHTS] {}; /* for the shader, valid slots only */
+    u32 budget = 6 * 512 * 512; /* face texels rendered per frame */
+    u32 nUsedTexels = 0; /* last schedule() */
+
+    ShadowAtlas() = default;
+    ShadowAtlas(const ShadowAtlas& other) = delete;
+    ~ShadowAtlas();
+
+    ShadowAtlas& operator=(const ShadowAtlas& other) = delete;
+
+    void create();
+    /* fills pUpdates with slots to render this frame and sets each light's shadow field, returns the update count */
+    u32 schedule(PointLight* pLights, u32 nLights, const Frustum& view, const v3& eye, f32 fov, u32* pUpdates, u32 maxUpdates);
+    u32 faceSize(u32 slot) const { return CELL << this->aSlots[slot].tier; }
+    void faceViewport(u32 slot, u32 face, GLint* pX, GLint* pY) const;
+
+private:
+    struct Candidate
+    {
+        u32 light;
+        f32 coverage;
+    };
+
+    u32 frame = 0;
+    bool aCells[CELLS * CELLS] {};
+
+    /* kept between frames to avoid allocations */
+    std::vector<Candidate> aCandidates;
+    std::vector<bool> aRanked;
+    std::vector<s32> aLightSlots; /* light -> slot */
+
+    bool alloc(u32 slot, u32 tier);
+    void free(u32 slot);
+    void fillCells(const Slot& s, bool bUsed);
+};
@@ -52,6 +52,17 @@ Texture::loadBMP(std::string_view path, TEX_TYPE type, bool flip, GLint texMode,
     this->texPath = path;
     this->type = type;
 
+    auto img = decodeBMP(path, flip);
+    setTexture(img.aPixels.data(), texMode, img.format, img.width, img.height, c);
+
+#ifdef TEXTURE
+    LOG(OK, "{}: id: {}, texMode: {}\n", path, this->id, img.format);
+#endif
+}
+
+ImageData
+decodeBMP(std::string_view path, bool flip)
+{
     u32 imageDataAddress;
     s32 width;
     s32 height;
@@ -131,18 +142,18 @@ Texture::loadBMP(std::string_view path, TEX_TYPE type, bool flip, GLint texMode,
             break;
     }
 
-    setTexture(pixels.data(), texMode, format, width, height, c);
-
-#ifdef TEXTURE
-    LOG(OK, "{}: id: {}, texMode: {}\n", path, this->id, format);
-#endif
+    return {
+        .aPixels = std::move(pixels),
+        .format = format,
+        .width = width,
+        .height = height
+    };
 }
 
 void
-Texture::bind(GLint glTexture)
+Texture::bind(GLint glTexture) const
 {
-    glActiveTexture(glTexture);
-    glBindTexture(GL_TEXTURE_2D, this->id);
+    gl::bindTexture(glTexture, GL_TEXTURE_2D, this->id);
 }
 
 void
@@ -151,6 +162,20 @@ Texture::setTexture(u8* pData, GLint texMode, GLint format, GLsizei width, GLsiz
     std::lock_guard lock(gl::mtxGlContext);
     c->bindGlContext();
 
+    this->create(pData, texMode, format, width, height);
+
+    c->unbindGlContext();
+}
+
+void
+Texture::upload(const ImageData& img, GLint texMode)
+{
+    this->create(img.aPixels.data(), texMode, img.format, img.width, img.height);
+}
+
+void
+Texture::create(const u8* pData, GLint texMode, GLint format, GLsizei width, GLsizei height)
+{
     glGenTextures(1, &this->id);
     glBindTexture(GL_TEXTURE_2D, this->id);
     /* set the texture wrapping parameters */
@@ -162,8 +187,6 @@ Texture::setTexture(u8* pData, GLint texMode, GLint format, GLsizei width, GLsiz
     /* load image, create texture and generate mipmaps */
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pData);
     glGenerateMipmap(GL_TEXTURE_2D);
-
-    c->unbindGlContext();
 }
 
 CubeMapProjections::CubeMapProjections(const m4 proj, const v3 pos)
@@ -256,9 +279,62 @@ createCubeShadowMap(const int width, const int height)
     if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER))
         LOG(FATAL, "glCheckFramebufferStatus != GL_FRAMEBUFFER_COMPLETE\n"); 
 
+    CubeMap res {{fbo, depthCubeMap, width, height}, {}};
+
+    glGenFramebuffers(6, res.aFaceFbos);
+    for (GLuint i = 0; i < 6; i++)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, res.aFaceFbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, depthCubeMap, 0);
+        glDrawBuffers(1, &none);
+        glReadBuffer(GL_NONE);
+
+        if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER))
+            LOG(FATAL, "glCheckFramebufferStatus != GL_FRAMEBUFFER_COMPLETE\n"); 
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return res;
+}
+
+CubeMap
+createCubeMomentMap(const int width, const int height, GLenum format)
+{
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, format, width, height);
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex, 0);
+
+    if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER))
+        LOG(FATAL, "glCheckFramebufferStatus != GL_FRAMEBUFFER_COMPLETE\n");
+
+    CubeMap res {{fbo, tex, width, height}, {}};
+
+    glGenFramebuffers(6, res.aFaceFbos);
+    for (GLuint i = 0; i < 6; i++)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, res.aFaceFbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, tex, 0);
+
+        if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER))
+            LOG(FATAL, "glCheckFramebufferStatus != GL_FRAMEBUFFER_COMPLETE\n");
+    }
+
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    return {fbo, depthCubeMap, width, height};
+    return res;
 }
 
 /* complains about unaligned address */
@@ -5,6 +5,7 @@
 #include "gl/gl.hh"
 
 #include <string>
+#include <vector>
 
 enum TEX_TYPE : int
 {
@@ -12,6 +13,15 @@ enum TEX_TYPE : int
     NORMAL
 };
 
+/* decoded pixels waiting for upload */
+struct ImageData
+{
+    std::vector<u8> aPixels;
+    GLint format;
+    GLsizei width;
+    GLsizei height;
+};
+
 struct Texture
 {
     GLuint id = 0;
@@ -25,10 +35,12 @@ struct Texture
     ~Texture();
 
     void loadBMP(std::string_view path, TEX_TYPE type, bool flip, GLint texMode, App* c);
-    void bind(GLint glTexture);
+    void upload(const ImageData& img, GLint texMode); /* caller should own the gl context */
+    void bind(GLint glTexture) const;
 
 private:
     void setTexture(u8* data, GLint texMode, GLint format, GLsizei width, GLsizei height, App* c);
+    void create(const u8* data, GLint texMode, GLint format, GLsizei width, GLsizei height);
 };
 
 struct ShadowMap
@@ -41,6 +53,7 @@ struct ShadowMap
 
 struct CubeMap : ShadowMap
 {
+    GLuint aFaceFbos[6]; /* one face attached each, fbo has the whole cube for layered rendering */
 };
 
 struct CubeMapProjections
@@ -52,8 +65,10 @@ struct CubeMapProjections
     m4& operator[](size_t i) { return tms[i]; }
 };
 
+ImageData decodeBMP(std::string_view path, bool flip);
 ShadowMap createShadowMap(const int width, const int height);
 CubeMap createCubeShadowMap(const int width, const int height);
+CubeMap createCubeMomentMap(const int width, const int height, GLenum format); /* filterable color cube, GL_RG32F or GL_RG16F */
 void flipCpyBGRAtoRGBA(u8* dest, u8* src, int width, int height, bool vertFlip);
 void flipCpyBGRtoRGB(u8* dest, u8* src, int width, int height, bool vertFlip);
 void flipCpyBGRtoRGBA(u8* dest, u8* src, int width, int height, bool vertFlip);
@@ -0,0 +1,282 @@
+#include "transforms.hh"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+    #include <immintrin.h>
+#endif
+
+/* nodes per pool task, smaller batches are not worth the synchronization */
+constexpr size_t PARALLEL_CHUNK = 1 << 14;
+
+template<typename F>
+static void
+parallelFor(ThreadPool* pTp, size_t n, F f)
+{
+    if (!pTp || n <= PARALLEL_CHUNK)
+    {
+        f(0, n);
+        return;
+    }
+
+    for (size_t i = 0; i < n; i += PARALLEL_CHUNK)
+        pTp->submit([=]{ f(i, std::min(i + PARALLEL_CHUNK, n)); });
+    pTp->wait();
+}
+
+#ifdef __SSE2__
+/* rows of one column of 4 matrices -> that column of each matrix */
+static inline void
+storeColumn4(__m128 r0, __m128 r1, __m128 r2, __m128 r3, int col, m4* pOut)
+{
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(pOut[0].v[col].e, r0);
+    _mm_storeu_ps(pOut[1].v[col].e, r1);
+    _mm_storeu_ps(pOut[2].v[col].e, r2);
+    _mm_storeu_ps(pOut[3].v[col].e, r3);
+}
+#endif
+
+#ifdef __AVX__
+/* same expressions as qtRot and m4Scale, so the results match m4TRS exactly */
+static void
+trsToM4x8(const TransformBatch& b, size_t i, m4* pOut)
+{
+    auto mul = [](__m256 l, __m256 r) { return _mm256_mul_ps(l, r); };
+    auto add = [](__m256 l, __m256 r) { return _mm256_add_ps(l, r); };
+    auto sub = [](__m256 l, __m256 r) { return _mm256_sub_ps(l, r); };
+
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+
+    __m256 x = _mm256_loadu_ps(&b.rx[i]), y = _mm256_loadu_ps(&b.ry[i]);
+    __m256 z = _mm256_loadu_ps(&b.rz[i]), s = _mm256_loadu_ps(&b.rw[i]);
+    __m256 x2 = mul(two, x), y2 = mul(two, y), z2 = mul(two, z), s2 = mul(two, s);
+    __m256 sx = _mm256_loadu_ps(&b.sx[i]), sy = _mm256_loadu_ps(&b.sy[i]), sz = _mm256_loadu_ps(&b.sz[i]);
+
+    __m256 e[4][4] {
+        {
+            mul(sub(sub(one, mul(y2, y)), mul(z2, z)), sx),
+            mul(add(mul(x2, y), mul(s2, z)), sx),
+            mul(sub(mul(x2, z), mul(s2, y)), sx),
+            _mm256_setzero_ps()
+        },
+        {
+            mul(sub(mul(x2, y), mul(s2, z)), sy),
+            mul(sub(sub(one, mul(x2, x)), mul(z2, z)), sy),
+            mul(add(mul(y2, z), mul(s2, x)), sy),
+            _mm256_setzero_ps()
+        },
+        {
+            mul(add(mul(x2, z), mul(s2, y)), sz),
+            mul(sub(mul(y2, z), mul(s2, x)), sz),
+            mul(sub(sub(one, mul(x2, x)), mul(y2, y)), sz),
+            _mm256_setzero_ps()
+        },
+        {_mm256_loadu_ps(&b.tx[i]), _mm256_loadu_ps(&b.ty[i]), _mm256_loadu_ps(&b.tz[i]), one}
+    };
+
+    for (int c = 0; c < 4; c++)
+    {
+        storeColumn4(_mm256_castps256_ps128(e[c][0]), _mm256_castps256_ps128(e[c][1]),
+                     _mm256_castps256_ps128(e[c][2]), _mm256_castps256_ps128(e[c][3]), c, pOut);
+        storeColumn4(_mm256_extractf128_ps(e[c][0], 1), _mm256_extractf128_ps(e[c][1], 1),
+                     _mm256_extractf128_ps(e[c][2], 1), _mm256_extractf128_ps(e[c][3], 1), c, pOut + 4);
+    }
+}
+#endif
+
+#ifdef __SSE2__
+static void
+trsToM4x4(const TransformBatch& b, size_t i, m4* pOut)
+{
+    auto mul = [](__m128 l, __m128 r) { return _mm_mul_ps(l, r); };
+    auto add = [](__m128 l, __m128 r) { return _mm_add_ps(l, r); };
+    auto sub = [](__m128 l, __m128 r) { return _mm_sub_ps(l, r); };
+
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 zero = _mm_setzero_ps();
+
+    __m128 x = _mm_loadu_ps(&b.rx[i]), y = _mm_loadu_ps(&b.ry[i]);
+    __m128 z = _mm_loadu_ps(&b.rz[i]), s = _mm_loadu_ps(&b.rw[i]);
+    __m128 x2 = mul(two, x), y2 = mul(two, y), z2 = mul(two, z), s2 = mul(two, s);
+    __m128 sx = _mm_loadu_ps(&b.sx[i]), sy = _mm_loadu_ps(&b.sy[i]), sz = _mm_loadu_ps(&b.sz[i]);
+
+    storeColumn4(mul(sub(sub(one, mul(y2, y)), mul(z2, z)), sx),
+                 mul(add(mul(x2, y), mul(s2, z)), sx),
+                 mul(sub(mul(x2, z), mul(s2, y)), sx),
+                 zero, 0, pOut);
+    storeColumn4(mul(sub(mul(x2, y), mul(s2, z)), sy),
+                 mul(sub(sub(one, mul(x2, x)), mul(z2, z)), sy),
+                 mul(add(mul(y2, z), mul(s2, x)), sy),
+                 zero, 1, pOut);
+    storeColumn4(mul(add(mul(x2, z), mul(s2, y)), sz),
+                 mul(sub(mul(y2, z), mul(s2, x)), sz),
+                 mul(sub(sub(one, mul(x2, x)), mul(y2, y)), sz),
+                 zero, 2, pOut);
+    storeColumn4(_mm_loadu_ps(&b.tx[i]), _mm_loadu_ps(&b.ty[i]), _mm_loadu_ps(&b.tz[i]), one, 3, pOut);
+}
+#endif
+
+void
+TransformBatch::resize(size_t n)
+{
+    this->tx.resize(n, 0.0f);
+    this->ty.resize(n, 0.0f);
+    this->tz.resize(n, 0.0f);
+    this->rx.resize(n, 0.0f);
+    this->ry.resize(n, 0.0f);
+    this->rz.resize(n, 0.0f);
+    this->rw.resize(n, 1.0f);
+    this->sx.resize(n, 1.0f);
+    this->sy.resize(n, 1.0f);
+    this->sz.resize(n, 1.0f);
+    this->aParents.resize(n, -1);
+    this->aMatrixIdxs.resize(n, -1);
+    this->aWorld.resize(n, m4Iden());
+    this->bLevelsValid = false;
+}
+
+void
+TransformBatch::set(size_t i, const v3& t, const qt& r, const v3& s)
+{
+    this->tx[i] = t.x;
+    this->ty[i] = t.y;
+    this->tz[i] = t.z;
+    this->rx[i] = r.x;
+    this->ry[i] = r.y;
+    this->rz[i] = r.z;
+    this->rw[i] = r.s;
+    this->sx[i] = s.x;
+    this->sy[i] = s.y;
+    this->sz[i] = s.z;
+}
+
+void
+TransformBatch::setParent(size_t i, s32 parent)
+{
+    this->aParents[i] = parent;
+    this->bLevelsValid = false;
+}
+
+void
+TransformBatch::setMatrix(size_t i, const m4& m)
+{
+    if (this->aMatrixIdxs[i] < 0)
+    {
+        this->aMatrixIdxs[i] = this->aMatrices.size();
+        this->aMatrices.push_back(m);
+    }
+    else this->aMatrices[this->aMatrixIdxs[i]] = m;
+}
+
+/* counting sort by depth, parents are always placed before their children */
+void
+TransformBatch::computeLevels()
+{
+    size_t n = this->size();
+    std::vector<u32> aDepths(n);
+    u32 nLevels = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        s32 p = this->aParents[i];
+        aDepths[i] = p < 0 ? 0 : aDepths[p] + 1;
+        nLevels = std::max(nLevels, aDepths[i] + 1);
+    }
+
+    this->aLevelEnds.assign(nLevels, 0);
+    for (u32 d : aDepths)
+        this->aLevelEnds[d]++;
+    for (u32 l = 1; l < nLevels; l++)
+        this->aLevelEnds[l] += this->aLevelEnds[l - 1];
+
+    std::vector<u32> aFill(nLevels, 0);
+    for (u32 l = 1; l < nLevels; l++)
+        aFill[l] = this->aLevelEnds[l - 1];
+
+    this->aLevelOrder.resize(n);
+    for (size_t i = 0; i < n; i++)
+        this->aLevelOrder[aFill[aDepths[i]]++] = i;
+
+    this->bLevelsValid = true;
+}
+
+void
+TransformBatch::computeLocal(size_t first, size_t end, m4* pOut) const
+{
+    size_t i = first;
+
+#ifdef __AVX__
+    for (; i + 8 <= end; i += 8)
+        trsToM4x8(*this, i, &pOut[i - first]);
+#endif
+#ifdef __SSE2__
+    for (; i + 4 <= end; i += 4)
+        trsToM4x4(*this, i, &pOut[i - first]);
+#endif
+    for (; i < end; i++)
+    {
+        pOut[i - first] = m4TRS({this->tx[i], this->ty[i], this->tz[i]},
+                                {this->rx[i], this->ry[i], this->rz[i], this->rw[i]},
+                                {this->sx[i], this->sy[i], this->sz[i]});
+    }
+
+    for (i = first; i < end; i++)
+        if (this->aMatrixIdxs[i] >= 0)
+            pOut[i - first] = this->aMatrices[this->aMatrixIdxs[i]] * pOut[i - first];
+}
+
+void
+TransformBatch::update(const m4& tmGlobal, ThreadPool* pTp)
+{
+    size_t n = this->size();
+
+    /* in order pass has better locality when there is nothing to split */
+    if (!pTp || n <= PARALLEL_CHUNK)
+    {
+        this->updateRange(0, n, tmGlobal);
+        return;
+    }
+
+    if (!this->bLevelsValid)
+        this->computeLevels();
+
+    this->aLocal.resize(n);
+    parallelFor(pTp, n, [&](size_t first, size_t end) { this->computeLocal(first, end, &this->aLocal[first]); });
+
+    u32 levelStart = 0;
+    for (u32 levelEnd : this->aLevelEnds)
+    {
+        parallelFor(pTp, levelEnd - levelStart, [&, levelStart](size_t first, size_t end) {
+            for (size_t k = levelStart + first; k < levelStart + end; k++)
+            {
+                u32 i = this->aLevelOrder[k];
+                s32 p = this->aParents[i];
+                this->aWorld[i] = (p < 0 ? tmGlobal : this->aWorld[p]) * this->aLocal[i];
+            }
+        });
+        levelStart = levelEnd;
+    }
+}
+
+void
+TransformBatch::updateRange(size_t first, size_t end, const m4& tmGlobal)
+{
+    /* local matrices go through a small buffer that stays in cache */
+    constexpr size_t BLOCK = 64;
+    m4 aBlock[BLOCK];
+
+    for (size_t b = first; b < end; b += BLOCK)
+    {
+        size_t blockEnd = std::min(b + BLOCK, end);
+        this->computeLocal(b, blockEnd, aBlock);
+
+        for (size_t i = b; i < blockEnd; i++)
+        {
+            s32 p = this->aParents[i];
+            this->aWorld[i] = (p < 0 ? tmGlobal : this->aWorld[p]) * aBlock[i - b];
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "gmath.hh"
+#include "threadpool.hh"
+
+/* local transforms of many nodes kept as separate component lanes, so that trs -> matrix runs 8 (4 without avx) nodes at a time.
+ * nodes must be in topological order: parents come before their children */
+struct TransformBatch
+{
+    std::vector<f32> tx, ty, tz;
+    std::vector<f32> rx, ry, rz, rw;
+    std::vector<f32> sx, sy, sz;
+    std::vector<s32> aParents; /* -1 for roots */
+    std::vector<s32> aMatrixIdxs; /* into aMatrices, -1 if the node has trs only */
+    std::vector<m4> aMatrices; /* applied before trs, like gltf node.matrix */
+    std::vector<m4> aWorld;
+
+    size_t size() const { return this->aParents.size(); }
+    void resize(size_t n);
+    void set(size_t i, const v3& t, const qt& r, const v3& s);
+    void setParent(size_t i, s32 parent);
+    void setMatrix(size_t i, const m4& m);
+    void update(const m4& tmGlobal, ThreadPool* pTp = nullptr); /* every node, pool is used only for large batches */
+    void updateRange(size_t first, size_t end, const m4& tmGlobal); /* parents outside of the range must be up to date */
+
+private:
+    std::vector<u32> aLevelOrder; /* nodes sorted by depth, nodes of one level don't depend on each other */
+    std::vector<u32> aLevelEnds;
+    std::vector<m4> aLocal; /* only needed when levels are split across the pool */
+    bool bLevelsValid = false;
+
+    void computeLevels();
+    void computeLocal(size_t first, size_t end, m4* pOut) const; /* pOut[0] is node first */
+};
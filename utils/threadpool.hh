@@ -57,11 +57,8 @@ public:
     void
     wait()
     {
-        while (this->busy())
-        {
-            std::unique_lock lock(this->mtxWait);
-            cndWait.wait(lock);
-        }
+        std::unique_lock lock(this->mtxWait);
+        this->cndWait.wait(lock, [this]{ return !this->busy(); });
     }
 
     void
@@ -122,7 +119,11 @@ private:
             this->activeTasks--;
 
             if (!this->busy())
-                this->cndWait.notify_one(); /* signal for the `wait()` */
+            {
+                /* take the lock so the signal can't land between `wait()`'s check and its sleep */
+                std::unique_lock lock(this->mtxWait);
+                this->cndWait.notify_all();
+            }
         }
     }
 };
@@ -104,6 +104,17 @@ timeNowS()
     return static_cast<f64>(t) / 1000.0;
 }
 
+static inline f64
+timeNowMS()
+{
+    long t =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+
+    return static_cast<f64>(t) / 1000.0;
+}
+
 static inline std::string
 replacePathSuffix(std::string_view path, std::string_view suffix)
 {